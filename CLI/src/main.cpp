@@ -6,9 +6,153 @@
 //  Copyright © 2018 Indi Kernick. All rights reserved.
 //
 
+#include <thread>
+#include <fstream>
+#include <sstream>
 #include <iostream>
+#include <algorithm>
+#include <STELA/llvm.hpp>
+#include <llvm/IR/Module.h>
+#include <STELA/code generation.hpp>
+#include <STELA/syntax analysis.hpp>
+#include <STELA/c standard library.hpp>
+#include <STELA/semantic analysis.hpp>
 
-int main(int, const char *[]) {
-  std::cout << "The CLI is yet to be implemented\n";
+using namespace stela;
+
+namespace {
+
+struct Options {
+  std::vector<std::string> inputs;
+  std::string output;
+  FileKind kind = FileKind::object;
+  OptFlags opt = opt_all;
+  const char *cpu = nullptr;
+  const char *features = nullptr;
+  bool boundsChecks = true;
+  unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+  bool verbose = false;
+};
+
+void printUsage(const char *name) {
+  std::cerr << "Usage: " << name << " [-v] [-O0] [-j threads] [-mcpu=cpu] [-mattr=features] [-fno-bounds-check] -o output inputs...\n";
+  std::cerr << "The output is an object (.o), archive (.a) or shared library (.so, .dylib)\n";
+  std::cerr << "The generic CPU is used unless -mcpu is given\n";
+}
+
+bool endsWith(const std::string &str, const std::string_view suffix) {
+  return str.size() >= suffix.size() &&
+         str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+bool readKind(Options &options) {
+  if (endsWith(options.output, ".o")) {
+    options.kind = FileKind::object;
+  } else if (endsWith(options.output, ".a")) {
+    options.kind = FileKind::archive;
+  } else if (endsWith(options.output, ".so") || endsWith(options.output, ".dylib")) {
+    options.kind = FileKind::shared;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+bool readOptions(Options &options, const int argc, const char *argv[]) {
+  for (int a = 1; a != argc; ++a) {
+    const std::string_view arg = argv[a];
+    if (arg == "-v") {
+      options.verbose = true;
+    } else if (arg == "-O0") {
+      options.opt = opt_none;
+    } else if (arg == "-fno-bounds-check") {
+      options.boundsChecks = false;
+    } else if (arg.substr(0, 6) == "-mcpu=") {
+      options.cpu = argv[a] + 6;
+    } else if (arg.substr(0, 7) == "-mattr=") {
+      options.features = argv[a] + 7;
+    } else if (arg == "-o" || arg == "-j") {
+      if (++a == argc) {
+        return false;
+      }
+      if (arg == "-o") {
+        options.output = argv[a];
+      } else {
+        const int threads = std::atoi(argv[a]);
+        if (threads <= 0) {
+          return false;
+        }
+        options.threads = static_cast<unsigned>(threads);
+      }
+    } else if (!arg.empty() && arg[0] == '-') {
+      return false;
+    } else {
+      options.inputs.emplace_back(arg);
+    }
+  }
+  return !options.inputs.empty() && readKind(options);
+}
+
+std::string readFile(const std::string &path) {
+  std::ifstream file{path};
+  if (!file.is_open()) {
+    std::cerr << "Failed to open \"" << path << "\"\n";
+    throw FatalError{};
+  }
+  std::stringstream stream;
+  stream << file.rdbuf();
+  return stream.str();
+}
+
+bool imports(const ASTs &asts, const std::string_view name) {
+  bool imported = false;
+  bool provided = false;
+  for (const AST &ast : asts) {
+    imported |= std::find(ast.imports.cbegin(), ast.imports.cend(), name) != ast.imports.cend();
+    provided |= ast.name == name;
+  }
+  return imported && !provided;
+}
+
+void compile(const Options &options, LogSink &sink) {
+  std::vector<std::string> sources;
+  for (const std::string &path : options.inputs) {
+    sources.push_back(readFile(path));
+  }
+  const std::vector<std::string_view> views{sources.cbegin(), sources.cend()};
+  
+  ASTs asts = createASTs(views, sink, options.threads);
+  Symbols syms = initModules(sink);
+  if (imports(asts, "cmath")) {
+    asts.push_back(makeCmath(syms.builtins, sink));
+  }
+  compileModules(syms, asts, sink, options.threads);
+  
+  initLLVM();
+  CompileCtx ctx;
+  OptFlags opt = options.opt;
+  opt.cpu = options.cpu;
+  opt.features = options.features;
+  opt.boundsChecks = options.boundsChecks;
+  std::unique_ptr<llvm::Module> module = generateIR(ctx, syms, sink, nullptr, opt);
+  generateFile(std::move(module), options.output, options.kind, sink, opt);
+}
+
+}
+
+int main(const int argc, const char *argv[]) {
+  Options options;
+  if (!readOptions(options, argc, argv)) {
+    printUsage(argv[0]);
+    return 1;
+  }
+  
+  ColorSink color;
+  FilterSink sink{color, options.verbose ? LogPri::status : LogPri::warning};
+  try {
+    compile(options, sink);
+  } catch (FatalError &) {
+    return 1;
+  }
   return 0;
 }
@@ -0,0 +1,160 @@
+//
+//  allocator.hpp
+//  STELA
+//
+//  Created by Indi Kernick on 18/10/26.
+//  Copyright © 2026 Indi Kernick. All rights reserved.
+//
+
+#ifndef stela_allocator_hpp
+#define stela_allocator_hpp
+
+#include <cstddef>
+#include <cstdlib>
+
+/* LCOV_EXCL_START */
+
+namespace stela {
+
+/// Memory allocation callbacks with the same semantics as malloc, free and
+/// realloc. The user pointer is passed to each callback so that an allocator
+/// can keep state like the number of bytes allocated. Generated code panics
+/// when null is returned
+struct Allocator {
+  void *(*allocate)(void *, size_t);
+  void (*deallocate)(void *, void *);
+  void *(*reallocate)(void *, void *, size_t);
+  void *user = nullptr;
+};
+
+extern "C" {
+
+/// A size-class pool with a free list for each class and a cache of free
+/// blocks on each thread. Allocations that are too big for a size class
+/// fall back to malloc. Allocations come from the arena of the thread when
+/// there is one (see ArenaScope). These have C linkage so that generated
+/// code and object files can call them by name
+void *stela_pool_alloc(size_t) noexcept;
+void stela_pool_free(void *) noexcept;
+void *stela_pool_realloc(void *, size_t) noexcept;
+
+}
+
+namespace detail {
+
+inline void *mallocAllocate(void *, const size_t size) noexcept {
+  return std::malloc(size);
+}
+
+inline void mallocDeallocate(void *, void *const ptr) noexcept {
+  std::free(ptr);
+}
+
+inline void *mallocReallocate(void *, void *const ptr, const size_t size) noexcept {
+  return std::realloc(ptr, size);
+}
+
+inline void *poolAllocate(void *, const size_t size) noexcept {
+  return stela_pool_alloc(size);
+}
+
+inline void poolDeallocate(void *, void *const ptr) noexcept {
+  stela_pool_free(ptr);
+}
+
+inline void *poolReallocate(void *, void *const ptr, const size_t size) noexcept {
+  return stela_pool_realloc(ptr, size);
+}
+
+inline thread_local const Allocator *current = nullptr;
+
+}
+
+constexpr Allocator malloc_allocator = {
+  detail::mallocAllocate,
+  detail::mallocDeallocate,
+  detail::mallocReallocate
+};
+
+/// The allocator that is used when none is given
+constexpr Allocator pool_allocator = {
+  detail::poolAllocate,
+  detail::poolDeallocate,
+  detail::poolReallocate
+};
+
+/// The allocator that objects created by the host are allocated with. Each
+/// thread has its own current allocator
+inline const Allocator &currentAllocator() noexcept {
+  return detail::current ? *detail::current : pool_allocator;
+}
+
+/// Make an allocator current on this thread until the scope is destroyed.
+/// Arrays and closures that are passed to generated code must be allocated
+/// with the allocator that the code was generated with. They must also be
+/// destroyed with it
+class AllocatorScope {
+public:
+  explicit AllocatorScope(const Allocator &allocator) noexcept
+    : prev{detail::current} {
+    detail::current = &allocator;
+  }
+  ~AllocatorScope() noexcept {
+    detail::current = prev;
+  }
+  
+  AllocatorScope(const AllocatorScope &) = delete;
+  AllocatorScope &operator=(const AllocatorScope &) = delete;
+
+private:
+  const Allocator *prev;
+};
+
+inline void *allocate(const size_t size) noexcept {
+  const Allocator &allocator = currentAllocator();
+  return allocator.allocate(allocator.user, size);
+}
+
+inline void deallocate(void *const ptr) noexcept {
+  const Allocator &allocator = currentAllocator();
+  allocator.deallocate(allocator.user, ptr);
+}
+
+struct ArenaChunk;
+class ArenaImpl;
+
+/// Allocations made by the pool on this thread come from a bump arena until
+/// the scope is destroyed. The memory of the arena is released in bulk when
+/// the scope is destroyed. Memory that is still in use, such as arrays that
+/// were stored in globals, keeps its part of the arena alive until it is
+/// freed. Scopes can be nested. Memory that was allocated before the scope
+/// is never moved into the arena
+class ArenaScope {
+public:
+  ArenaScope() noexcept;
+  ~ArenaScope() noexcept;
+  
+  ArenaScope(const ArenaScope &) = delete;
+  ArenaScope &operator=(const ArenaScope &) = delete;
+  
+  /// Stop allocating from the arena without releasing it. Values are
+  /// promoted out of the arena by copying them while it is suspended
+  void suspend() noexcept;
+
+private:
+  friend class ArenaImpl;
+  
+  ArenaScope *prev;
+  ArenaChunk *chunks = nullptr;
+  char *next = nullptr;
+  char *end = nullptr;
+};
+
+/// Whether a block allocated by the pool came from an arena
+bool isArenaBlock(const void *) noexcept;
+
+}
+
+/* LCOV_EXCL_END */
+
+#endif
@@ -40,7 +40,9 @@ class Visitor;
 
 //---------------------------------- Base --------------------------------------
 
-struct Node : ref_count {
+// Nodes are shared between the threads of the parallel front-end
+struct Node : atomic_ref_count {
+  Node();
   virtual ~Node();
   virtual void accept(Visitor &) = 0;
   
@@ -250,6 +252,9 @@ struct Subscript final : Expression {
   ExprPtr object;
   ExprPtr index;
   
+  // set during code generation if the index is always in bounds
+  bool inBounds = false;
+  
   void accept(Visitor &) override;
 };
 
@@ -263,6 +268,9 @@ struct Identifier final : Expression {
   // This remains set to ~uint32_t{} if the identifier does not refer to
   // a captured variable
   uint32_t captureIndex = ~uint32_t{};
+  // set during code generation if this is the last use of a local variable
+  // and the object can be moved from
+  bool lastUse = false;
   
   void accept(Visitor &) override;
 };
@@ -89,6 +89,8 @@ public:
   explicit Function(type *const ptr) noexcept
     : ptr{ptr} {}
   
+  /// Returned arrays might be immortal storage that belongs to the engine
+  /// (see own)
   template <typename... Args>
   inline Ret operator()(Args &&... args) noexcept {
     std::tuple<Params...> params{std::forward<Args>(args)...};
@@ -96,6 +98,23 @@ public:
     return call(params, Indicies{});
   }
   
+  /// Call the function with an arena (see ArenaScope). Memory that the call
+  /// allocates is released in bulk when it returns. Returned arrays are
+  /// copied out of the arena. The function must have been generated without
+  /// a custom allocator (see OptFlags::allocator)
+  template <typename... Args>
+  inline Ret inArena(Args &&... args) noexcept {
+    ArenaScope arena;
+    if constexpr (std::is_void_v<Ret>) {
+      (*this)(std::forward<Args>(args)...);
+    } else {
+      Ret ret = (*this)(std::forward<Args>(args)...);
+      arena.suspend();
+      promote(ret);
+      return ret;
+    }
+  }
+  
 private:
   type *ptr;
 };
@@ -0,0 +1,62 @@
+//
+//  build session.hpp
+//  STELA
+//
+//  Created by Indi Kernick on 18/10/26.
+//  Copyright © 2026 Indi Kernick. All rights reserved.
+//
+
+#ifndef stela_build_session_hpp
+#define stela_build_session_hpp
+
+#include <unordered_map>
+#include "code generation.hpp"
+
+namespace stela {
+
+/// Keeps the symbols, IR and machine code of each module between builds.
+/// When a module changes, only that module and the modules that import it
+/// (directly or indirectly) are recompiled. Each module is compiled into its
+/// own engine and only sees the modules that it imports
+class BuildSession {
+public:
+  explicit BuildSession(OptFlags = opt_all, llvm::ObjectCache * = nullptr);
+  ~BuildSession();
+  
+  BuildSession(const BuildSession &) = delete;
+  BuildSession &operator=(const BuildSession &) = delete;
+  
+  /// Add a module or replace the source of a module. The name of the module
+  /// is read from the source on the next build
+  void setSource(std::string);
+  /// Remove a module on the next build. Removals are applied before new
+  /// sources
+  void remove(std::string_view);
+  /// Compile the modules that are out of date. Returns the names of the
+  /// modules that were compiled in the order that they were compiled.
+  /// Modules that fail to compile are retried on the next build
+  std::vector<std::string> build(LogSink &);
+  /// Get the engine of a module. Returns nullptr if the module hasn't been
+  /// built
+  llvm::ExecutionEngine *engine(std::string_view) const;
+
+private:
+  struct Module;
+  
+  CompileCtx comp;
+  Symbols syms;
+  std::unordered_map<std::string, std::unique_ptr<Module>> modules;
+  std::vector<std::string> pending;
+  std::vector<std::string> removed;
+  OptFlags opt;
+  llvm::ObjectCache *cache;
+  
+  void unload(Module &);
+  void collectImports(ast::Names &, const Module &) const;
+  void exportSymbols(const std::string &, Module &);
+  void generate(const std::string &, Module &, LogSink &);
+};
+
+}
+
+#endif
@@ -10,30 +10,153 @@
 #define stela_code_generation_hpp
 
 #include "log.hpp"
+#include "llvm.hpp"
+#include <chrono>
 #include "symbols.hpp"
+#include <functional>
+#include "compile stats.hpp"
 
 namespace llvm {
 
-class ExecutionEngine;
-class Module;
+class ObjectCache;
 
 }
 
 namespace stela {
 
+/// Optimization pipelines
+enum class OptPreset {
+  /// Cheap simplifications for code that runs a few times
+  compile_time,
+  /// The standard pipeline without the more expensive transformations
+  balanced,
+  /// Everything that might make the code faster
+  max_throughput
+};
+
 struct OptFlags {
   bool inliner = true;
   bool vectorize = true;
   bool optimizeIR = true;
   bool optimizeASM = true;
+  /// Count how many times each block is executed so that the counts can be
+  /// written with writeProfile. Requires optimizeIR and the eager backend
+  /// with one thread
+  bool instrument = false;
+  /// Path to a profile written by writeProfile. The profile guides inlining,
+  /// block layout and branch weights. Requires optimizeIR. The eager backend
+  /// must use one thread because splitting the module renames internal
+  /// functions which would drop their counts
+  const char *profile = nullptr;
+  /// The pipeline used when optimizeIR is set. Also selects the code
+  /// generator optimization level when optimizeASM is set
+  OptPreset preset = OptPreset::max_throughput;
+  /// The CPU to generate code for. The host CPU is used when this is null
+  /// except by generateFile which uses a generic CPU
+  const char *cpu = nullptr;
+  /// Comma separated features to enable or disable like "+avx2,-avx512f".
+  /// When this and cpu are both null, the features of the host CPU are used
+  const char *features = nullptr;
+  /// Panic when an array is indexed out of bounds. Checks are removed from
+  /// loops over an array when the index is known to be in bounds. Disabling
+  /// this removes every check so it should only be done for trusted code.
+  /// Only used by generateIR
+  bool boundsChecks = true;
+  /// Remove increments and decrements of reference counts that cancel each
+  /// other out. Requires the inliner
+  bool elideRefCounts = true;
+  /// Change reference counts atomically so that arrays and closures can be
+  /// shared between threads. Releasing the only reference to an object
+  /// skips the atomic operation. The host must create a SharedArraysScope
+  /// before sharing objects between threads. Only used by generateIR
+  bool atomicRefCounts = false;
+  /// Memory is allocated and freed with these callbacks instead of malloc
+  /// and free. The callbacks are copied into the code so the allocator only
+  /// needs to outlive the generateIR call but the user pointer must outlive
+  /// the engine. generateFile rejects the code and object caches don't store
+  /// it. Only used by generateIR
+  const Allocator *allocator = nullptr;
 };
 
 constexpr OptFlags opt_all = {};
 constexpr OptFlags opt_none = {false, false, false, false};
 
-std::unique_ptr<llvm::Module> generateIR(const Symbols &, LogSink &);
-llvm::ExecutionEngine *generateCode(std::unique_ptr<llvm::Module>, LogSink &, OptFlags = opt_all);
-llvm::ExecutionEngine *generateCode(const Symbols &, LogSink &, OptFlags = opt_all);
+/// Create an object cache that stores object files in the given directory.
+/// Object files are keyed on a hash of the IR, the OptFlags and the host CPU
+/// so a warm start can load machine code straight from disk
+std::unique_ptr<llvm::ObjectCache> makeObjectCache(std::string);
+
+/// Time spent in an optimization pass, excluding the passes that it runs
+struct PassTime {
+  std::string name;
+  std::chrono::nanoseconds time;
+  size_t runs;
+};
+
+/// Passes are in the order that they first ran
+using PassTimings = std::vector<PassTime>;
+
+enum class Backend {
+  /// Compile the whole module with MCJIT before returning
+  eager,
+  /// Compile each function with ORC the first time it is called
+  lazy,
+  /// Compile the module with opt_none and then recompile extern functions
+  /// with EngineOpts::opt on a background thread once they are hot
+  tiered
+};
+
+struct EngineOpts {
+  OptFlags opt = opt_all;
+  Backend backend = Backend::eager;
+  /// Only used by the eager backend
+  llvm::ObjectCache *cache = nullptr;
+  /// Number of threads used to optimize and compile the module. Only used by
+  /// the eager backend. The cache is not used when this is greater than 1
+  unsigned threads = 1;
+  /// Called with the name of each symbol that the module refers to but does
+  /// not define. Returning 0 falls back to the symbols of the host process.
+  /// Only used by the eager and tiered backends when threads is 1
+  std::function<uint64_t(const std::string &)> findSymbol;
+  /// Number of calls before an extern function is recompiled. Only used by
+  /// the tiered backend
+  uint64_t tierThreshold = 1000;
+  /// The time spent in each optimization pass is added to this. Not used by
+  /// the lazy and tiered backends
+  PassTimings *timings = nullptr;
+  /// Optimization and machine code statistics are added to this. Only used
+  /// by the eager backend
+  CompileStats *stats = nullptr;
+};
+
+/// The module is created in the LLVMContext of the CompileCtx
+std::unique_ptr<llvm::Module> generateIR(CompileCtx &, const Symbols &, LogSink &, CompileStats * = nullptr, OptFlags = opt_all);
+std::unique_ptr<llvm::Module> generateIR(CompileCtx &, const ast::Decls &, LogSink &, CompileStats * = nullptr, OptFlags = opt_all);
+/// The returned engine is owned by the CompileCtx
+llvm::ExecutionEngine *generateCode(CompileCtx &, std::unique_ptr<llvm::Module>, LogSink &, const EngineOpts & = {});
+llvm::ExecutionEngine *generateCode(CompileCtx &, const Symbols &, LogSink &, const EngineOpts & = {});
+/// Wait for the functions that are hot to be recompiled. Returns the number
+/// of functions that have been recompiled. The engine must have been created
+/// with the tiered backend
+size_t finishTiering(llvm::ExecutionEngine *);
+/// Write the execution counts of an engine compiled with OptFlags::instrument
+/// to an indexed profile file
+void writeProfile(llvm::ExecutionEngine *, const std::string &, LogSink &);
+
+enum class FileKind {
+  /// Relocatable object file (.o)
+  object,
+  /// Static library (.a)
+  archive,
+  /// Shared library (.so or .dylib)
+  shared
+};
+
+/// Optimize the module and compile it ahead of time into a file for the host
+/// target. Extern functions and variables are exported. Extern functions
+/// that are implemented by the host are left undefined. The file must be
+/// linked with STELA for the functions of the pool allocator
+void generateFile(std::unique_ptr<llvm::Module>, const std::string &, FileKind, LogSink &, OptFlags = opt_all, PassTimings * = nullptr);
 
 }
 
@@ -0,0 +1,53 @@
+//
+//  compile stats.hpp
+//  STELA
+//
+//  Created by Indi Kernick on 18/10/26.
+//  Copyright © 2026 Indi Kernick. All rights reserved.
+//
+
+#ifndef stela_compile_stats_hpp
+#define stela_compile_stats_hpp
+
+#include <chrono>
+
+namespace stela {
+
+struct PhaseStats {
+  /// Wall time spent in the phase
+  std::chrono::nanoseconds time{};
+  /// Calls to operator new on the compiling thread. Only counted when STELA
+  /// is built with STELA_ALLOC_STATS
+  size_t allocations = 0;
+};
+
+/// Each phase adds to the stats so the same object can be passed to every
+/// phase of a compilation
+struct CompileStats {
+  /// tokenize
+  PhaseStats lexical;
+  /// createAST
+  PhaseStats syntax;
+  /// compileModule and compileModules
+  PhaseStats semantic;
+  /// generateIR
+  PhaseStats generate;
+  /// optimizeModule
+  PhaseStats optimize;
+  /// Machine code generation and linking
+  PhaseStats machine;
+  
+  size_t tokens = 0;
+  size_t nodes = 0;
+  size_t symbols = 0;
+  /// IR instructions created by generateIR
+  size_t instsGenerated = 0;
+  /// IR instructions given to the code generator
+  size_t instsOptimized = 0;
+  /// Bytes of executable code loaded into the engine
+  size_t machineBytes = 0;
+};
+
+}
+
+#endif
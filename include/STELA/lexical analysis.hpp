@@ -11,13 +11,14 @@
 
 #include "log.hpp"
 #include "token.hpp"
+#include "compile stats.hpp"
 
 namespace stela {
 
 /// Split a source file into tokens. Multiple std::string_views refer directly
 /// to the source string in later phases so the source should remain available
 /// until compilation is complete.
-Tokens tokenize(std::string_view, LogSink &);
+Tokens tokenize(std::string_view, LogSink &, CompileStats * = nullptr);
 
 }
 
@@ -9,19 +9,55 @@
 #ifndef stela_llvm_hpp
 #define stela_llvm_hpp
 
+#include <memory>
+#include <vector>
+
 namespace llvm {
 
+class Module;
 class LLVMContext;
+class ExecutionEngine;
 
 }
 
 namespace stela {
 
+class FuncInst;
+struct Allocator;
+
+/// Initialize the native target and the optimizers. This must be called
+/// before any code generation. Calling it more than once has no effect
 void initLLVM();
-void quitLLVM();
-[[nodiscard]] llvm::LLVMContext &getLLVM();
 [[nodiscard]] bool hasLLVM();
 
+/// The LLVM state of a single compilation. Compilations with different
+/// contexts can run on different threads at the same time. Engines generated
+/// with a context are destroyed along with it
+class CompileCtx {
+public:
+  CompileCtx();
+  ~CompileCtx();
+  
+  CompileCtx(const CompileCtx &) = delete;
+  CompileCtx &operator=(const CompileCtx &) = delete;
+  
+  [[nodiscard]] llvm::LLVMContext &llvm();
+  /// Start instantiating runtime functions into a new module. The runtime
+  /// functions call the allocator if it isn't null and change reference
+  /// counts atomically if the flag is set
+  [[nodiscard]] FuncInst &resetInst(llvm::Module *, const Allocator * = nullptr, bool = false);
+  /// Take ownership of an engine
+  llvm::ExecutionEngine *addEngine(llvm::ExecutionEngine *);
+  /// Destroy an engine owned by this context
+  void destroyEngine(llvm::ExecutionEngine *);
+
+private:
+  // the engines own modules that belong to the context
+  std::unique_ptr<llvm::LLVMContext> context;
+  std::unique_ptr<FuncInst> inst;
+  std::vector<std::unique_ptr<llvm::ExecutionEngine>> engines;
+};
+
 }
 
 #endif
@@ -15,6 +15,8 @@
 namespace stela {
 
 using ModuleOrder = std::vector<size_t>;
+/// Modules in the same wave don't depend on each other
+using ModuleWaves = std::vector<ModuleOrder>;
 
 /// Find the order which modules must be compiled in. Cyclic dependencies are
 /// not allowed
@@ -23,6 +25,12 @@ ModuleOrder findModuleOrder(const ASTs &, LogSink &);
 /// not allowed. Assumes that modules with the given names have already
 /// been compiled
 ModuleOrder findModuleOrder(const ASTs &, const ast::Names &, LogSink &);
+/// Group modules into waves. Each wave only depends on the waves before it
+/// so the modules within a wave can be compiled in parallel
+ModuleWaves findModuleWaves(const ASTs &, LogSink &);
+/// Group modules into waves. Assumes that modules with the given names have
+/// already been compiled
+ModuleWaves findModuleWaves(const ASTs &, const ast::Names &, LogSink &);
 
 }
 
@@ -21,8 +21,8 @@ Array<Elem> makeEmptyArray() noexcept {
 }
 
 template <typename Elem>
-Array<Elem> makeArray(const Uint size) noexcept {
-  return make_retain<ArrayStorage<Elem>>(size);
+Array<Elem> makeArray(const Len size) noexcept {
+  return allocArray<Elem>(size);
 }
 
 template <typename Elem, typename... Args>
@@ -9,31 +9,119 @@
 #ifndef stela_native_types_hpp
 #define stela_native_types_hpp
 
+#include <memory>
 #include "number.hpp"
+#include "allocator.hpp"
 #include "retain ptr.hpp"
 
 namespace stela {
 
+/// The length and capacity of an array. Scripts see lengths as uint so
+/// size and capacity panic when the length doesn't fit. Building with
+/// STELA_64BIT_LENGTHS lets arrays grow beyond 4G elements
+#ifdef STELA_64BIT_LENGTHS
+using Len = uint64_t;
+#else
+using Len = Uint;
+#endif
+
+/// String literals are immortal storage (see immortal_count) with read-only
+/// data. Generated code copies immortal storage before modifying it. The host
+/// must do the same (see own). The elements of a new array are allocated in
+/// the same block as the header (see allocArray) and are moved to their own
+/// memory when the array grows
 template <typename Elem>
 struct ArrayStorage : ref_count {
   ArrayStorage()
     : ref_count{} {}
-  explicit ArrayStorage(const Uint len)
+  /// The elements are allocated separately from the header. allocArray
+  /// allocates both in a single block
+  explicit ArrayStorage(const Len len)
     : ref_count{}, cap{len}, len{len}, dat{alloc<Elem>(len)} {}
   ~ArrayStorage() {
     std::destroy_n(dat, len);
-    dealloc(dat);
+    if (dat != inlineDat()) {
+      dealloc(dat);
+    }
+  }
+  
+  Elem *inlineDat() noexcept {
+    return reinterpret_cast<Elem *>(this + 1);
   }
 
   // uint64_t ref
-  Uint cap = 0;
-  Uint len = 0;
+  Len cap = 0;
+  Len len = 0;
   Elem *dat = nullptr;
 };
 
 template <typename Elem>
 using Array = retain_ptr<ArrayStorage<Elem>>;
 
+/// Allocate an array of uninitialized elements in a single block
+template <typename Elem>
+Array<Elem> allocArray(const Len len) noexcept {
+  static_assert(alignof(Elem) <= alignof(ArrayStorage<Elem>));
+  void *mem = allocate(sizeof(ArrayStorage<Elem>) + sizeof(Elem) * len);
+  auto *storage = new (mem) ArrayStorage<Elem>{};
+  storage->cap = len;
+  storage->len = len;
+  storage->dat = storage->inlineDat();
+  return Array<Elem>{storage};
+}
+
+/// Values that might refer to an arena are left alone unless they are arrays.
+/// Closures and other values keep their part of the arena alive instead
+template <typename Type>
+void promote(Type &) noexcept {}
+
+/// Copy an array and its nested arrays out of the arena that they were
+/// allocated in (see ArenaScope). This must be called while the arena is
+/// suspended
+template <typename Elem>
+void promote(Array<Elem> &array) noexcept {
+  if (!array || array.use_count() >= immortal_count / 2) {
+    return;
+  }
+  ArrayStorage<Elem> &storage = *array;
+  const bool separate = storage.dat && storage.dat != storage.inlineDat();
+  if (isArenaBlock(&storage) || (separate && isArenaBlock(storage.dat))) {
+    Array<Elem> copy = allocArray<Elem>(storage.len);
+    if (array.unique()) {
+      std::uninitialized_move_n(storage.dat, storage.len, copy->dat);
+    } else {
+      std::uninitialized_copy_n(storage.dat, storage.len, copy->dat);
+    }
+    array = std::move(copy);
+  }
+  for (Len i = 0; i != array->len; ++i) {
+    promote(array->dat[i]);
+  }
+}
+
+/// Values other than arrays never refer to immortal storage
+template <typename Type>
+void own(Type &) noexcept {}
+
+/// Copy an array and its nested arrays out of immortal storage. Immortal
+/// storage belongs to the engine that created it and its elements might be
+/// read-only. An array that was returned by generated code must be owned
+/// before its elements are modified or before it outlives the engine
+template <typename Elem>
+void own(Array<Elem> &array) noexcept {
+  if (!array) {
+    return;
+  }
+  if (array.use_count() >= immortal_count / 2) {
+    Array<Elem> copy = allocArray<Elem>(array->len);
+    std::uninitialized_copy_n(array->dat, array->len, copy->dat);
+    array = std::move(copy);
+  }
+  for (Len i = 0; i != array->len; ++i) {
+    own(array->dat[i]);
+  }
+}
+
 struct ClosureData : ref_count {
   ~ClosureData() {
     dtor(this);
@@ -10,27 +10,47 @@
 #define stela_retain_ptr_hpp
 
 #include <new>
+#include <atomic>
 #include <cstdint>
 #include <utility>
 #include <cassert>
 #include <cstdlib>
+#include <functional>
+#include "allocator.hpp"
+#include <type_traits>
 
 /* LCOV_EXCL_START */
 
 namespace stela {
 
+/// Allocate with the current allocator
 template <typename T>
 T *alloc(const size_t count = 1) noexcept {
-  return static_cast<T *>(std::malloc(sizeof(T) * count));
+  return static_cast<T *>(allocate(sizeof(T) * count));
 }
 
+/// Free with the current allocator
 inline void dealloc(void *const ptr) noexcept {
-  std::free(ptr);
+  deallocate(ptr);
 }
 
 template <typename T>
 class retain_ptr;
 
+/// Reference count of static storage that is never freed. Storage with a
+/// count of at least half of this is immortal
+constexpr uint64_t immortal_count = uint64_t{1} << 62;
+
+namespace detail {
+
+inline std::atomic<unsigned> shared_arrays = 0;
+inline std::atomic<unsigned> shared_objects = 0;
+
+}
+
+/// A reference count that is shared with generated code. The count is only
+/// changed atomically on the host while arrays might be shared between threads
+/// (see SharedArraysScope)
 struct ref_count {
   template <typename T>
   friend class retain_ptr;
@@ -39,7 +59,63 @@ protected:
   ref_count() = default;
 
 private:
-  uint64_t count = 1;
+  std::atomic<uint64_t> count = 1;
+};
+
+/// A reference count of an object that belongs to the compiler. The count is
+/// only changed atomically while the object might be shared between threads
+/// (see SharedObjectsScope)
+struct atomic_ref_count {
+  template <typename T>
+  friend class retain_ptr;
+  
+protected:
+  atomic_ref_count() = default;
+  // a copy is a new object so it starts with its own count
+  atomic_ref_count(const atomic_ref_count &) noexcept {}
+  atomic_ref_count &operator=(const atomic_ref_count &) noexcept {
+    return *this;
+  }
+
+private:
+  std::atomic<uint64_t> count = 1;
+};
+
+/// Objects with an atomic_ref_count belong to the compiler and are never
+/// seen by generated code so they are always allocated with malloc
+template <typename T>
+constexpr bool is_compiler_object = std::is_base_of_v<atomic_ref_count, T>;
+
+/// The reference counts of compiler objects change atomically while a scope
+/// exists. The parallel front-end creates one while it shares nodes between
+/// threads so that a single-threaded compile doesn't pay for atomics
+class SharedObjectsScope {
+public:
+  SharedObjectsScope() noexcept {
+    detail::shared_objects.fetch_add(1, std::memory_order_relaxed);
+  }
+  ~SharedObjectsScope() noexcept {
+    detail::shared_objects.fetch_sub(1, std::memory_order_relaxed);
+  }
+  
+  SharedObjectsScope(const SharedObjectsScope &) = delete;
+  SharedObjectsScope &operator=(const SharedObjectsScope &) = delete;
+};
+
+/// The reference counts of arrays and closures change atomically on the host
+/// while a scope exists. Create one before sharing objects between threads
+/// that run code generated with OptFlags::atomicRefCounts
+class SharedArraysScope {
+public:
+  SharedArraysScope() noexcept {
+    detail::shared_arrays.fetch_add(1, std::memory_order_relaxed);
+  }
+  ~SharedArraysScope() noexcept {
+    detail::shared_arrays.fetch_sub(1, std::memory_order_relaxed);
+  }
+  
+  SharedArraysScope(const SharedArraysScope &) = delete;
+  SharedArraysScope &operator=(const SharedArraysScope &) = delete;
 };
 
 struct retain_t {};
@@ -50,7 +126,7 @@ class retain_ptr {
 public:
   using element_type = T;
   using pointer = T *;
-
+  
   constexpr retain_ptr() noexcept
     : ptr{nullptr} {}
   constexpr retain_ptr(std::nullptr_t) noexcept
@@ -151,8 +227,7 @@ public:
   
   uint64_t use_count() const noexcept {
     if (ptr) {
-      ref_count *const refPtr = ptr;
-      return refPtr->count;
+      return refPtr()->count;
     } else {
       return 0;
     }
@@ -221,20 +296,73 @@ public:
 private:
   pointer ptr;
   
+  auto *refPtr() const noexcept {
+    if constexpr (std::is_base_of_v<atomic_ref_count, T>) {
+      return static_cast<atomic_ref_count *>(ptr);
+    } else {
+      return static_cast<ref_count *>(ptr);
+    }
+  }
+  
+  static bool atomicCount() noexcept {
+    if constexpr (is_compiler_object<T>) {
+      return detail::shared_objects.load(std::memory_order_relaxed) != 0;
+    } else {
+      return detail::shared_arrays.load(std::memory_order_relaxed) != 0;
+    }
+  }
+  
+  /// Immortal storage may be shared by engines and threads so its count is
+  /// never changed
+  static bool immortal(const std::atomic<uint64_t> *count) noexcept {
+    if constexpr (is_compiler_object<T>) {
+      return false;
+    } else {
+      return count->load(std::memory_order_relaxed) >= immortal_count / 2;
+    }
+  }
+  
   void incr() const noexcept {
     if (ptr) {
-      ref_count *const refPtr = ptr;
-      assert(refPtr->count != ~uint64_t{});
-      ++refPtr->count;
+      auto *const count = &refPtr()->count;
+      assert(*count != ~uint64_t{});
+      if (immortal(count)) {
+        return;
+      }
+      if (atomicCount()) {
+        count->fetch_add(1, std::memory_order_relaxed);
+      } else {
+        count->store(count->load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+      }
     }
   }
   
   void decr() const noexcept {
     if (ptr) {
-      ref_count *const refPtr = ptr;
-      assert(refPtr->count != 0);
-      if (--refPtr->count == 0) {
-        ptr->~T();
+      auto *const count = &refPtr()->count;
+      assert(*count != 0);
+      if (immortal(count)) {
+        return;
+      }
+      if (atomicCount()) {
+        // the only reference cannot be copied by another thread
+        if (
+          count->load(std::memory_order_acquire) != 1 &&
+          count->fetch_sub(1, std::memory_order_acq_rel) != 1
+        ) {
+          return;
+        }
+      } else {
+        const uint64_t newCount = count->load(std::memory_order_relaxed) - 1;
+        count->store(newCount, std::memory_order_relaxed);
+        if (newCount != 0) {
+          return;
+        }
+      }
+      ptr->~T();
+      if constexpr (is_compiler_object<T>) {
+        std::free(ptr);
+      } else {
         dealloc(ptr);
       }
     }
@@ -254,7 +382,12 @@ void swap(retain_ptr<T> &a, retain_ptr<T> &b) {
 
 template <typename T, typename... Args>
 retain_ptr<T> make_retain(Args &&... args) noexcept {
-  T *ptr = alloc<T>();
+  T *ptr;
+  if constexpr (is_compiler_object<T>) {
+    ptr = static_cast<T *>(std::malloc(sizeof(T)));
+  } else {
+    ptr = alloc<T>();
+  }
   new (ptr) T{std::forward<Args>(args)...};
   return retain_ptr<T>{ptr};
 }
@@ -13,6 +13,7 @@
 #include "ast.hpp"
 #include "symbols.hpp"
 #include "modules.hpp"
+#include "compile stats.hpp"
 
 namespace stela {
 
@@ -23,13 +24,24 @@ Symbols initModules(LogSink &);
 /// Perform semantic analysis on an AST and create a module. The declarations
 /// are moved out of the AST object and into Symbols. AST object can be
 /// discarded
-void compileModule(Symbols &, AST &, LogSink &);
+void compileModule(Symbols &, AST &, LogSink &, CompileStats * = nullptr);
 /// Perform semantic analysis on an AST and create a module.
-void compileModule(Symbols &, std::string_view, LogSink &);
+void compileModule(Symbols &, std::string_view, LogSink &, CompileStats * = nullptr);
+/// Perform semantic analysis on an AST and create a module without warning
+/// about unused symbols. checkUnused should be called once all modules that
+/// might refer to the symbols have been compiled
+void compileModuleUnchecked(Symbols &, AST &, LogSink &);
+/// Warn about symbols that are never referenced
+void checkUnused(const Symbols &, LogSink &);
 /// Compile the ASTs into Modules in the right order
-void compileModules(Symbols &, const ModuleOrder &, ASTs &, LogSink &);
+void compileModules(Symbols &, const ModuleOrder &, ASTs &, LogSink &, CompileStats * = nullptr);
 /// Compile the ASTs into Modules in the right order
-void compileModules(Symbols &, ASTs &, LogSink &);
+void compileModules(Symbols &, ASTs &, LogSink &, CompileStats * = nullptr);
+/// Compile each wave of modules on up to the given number of threads. A
+/// module can only see the modules in earlier waves
+void compileModules(Symbols &, const ModuleWaves &, ASTs &, LogSink &, unsigned, CompileStats * = nullptr);
+/// Compile the ASTs into Modules on up to the given number of threads
+void compileModules(Symbols &, ASTs &, LogSink &, unsigned, CompileStats * = nullptr);
 
 }
 
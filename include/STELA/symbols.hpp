@@ -11,6 +11,7 @@
 
 #include <string>
 #include <memory>
+#include <atomic>
 #include "ast.hpp"
 #include <unordered_map>
 
@@ -23,7 +24,8 @@ struct Symbol {
 
   Scope *scope = nullptr;
   Loc loc;
-  bool referenced = false;
+  // set by every module that refers to the symbol
+  std::atomic<bool> referenced = false;
 };
 using SymbolPtr = std::unique_ptr<Symbol>;
 
@@ -53,7 +55,9 @@ struct Scope {
     assert(type == ScopeType::func || type == ScopeType::closure);
   }
 
-  Scope *const parent;
+  // BuildSession relinks module scopes so that a module only sees the
+  // modules it imports
+  Scope *parent;
   const ScopeType type;
   sym::Symbol *const symbol;
   const ast::Name module;
@@ -12,11 +12,15 @@
 #include "log.hpp"
 #include "ast.hpp"
 #include "token.hpp"
+#include "compile stats.hpp"
 
 namespace stela {
 
-AST createAST(const Tokens &, LogSink &);
-AST createAST(std::string_view, LogSink &);
+AST createAST(const Tokens &, LogSink &, CompileStats * = nullptr);
+AST createAST(std::string_view, LogSink &, CompileStats * = nullptr);
+/// Tokenize and parse each source on up to the given number of threads. The
+/// ASTs are in the same order as the sources
+ASTs createASTs(const std::vector<std::string_view> &, LogSink &, unsigned);
 
 }
 
@@ -0,0 +1,308 @@
+//
+//  bounds checks.cpp
+//  STELA
+//
+//  Created by Indi Kernick on 18/10/26.
+//  Copyright © 2026 Indi Kernick. All rights reserved.
+//
+
+#include "bounds checks.hpp"
+
+#include <algorithm>
+#include <llvm/IR/Type.h>
+#include "generate type.hpp"
+#include "Utils/assert down cast.hpp"
+
+using namespace stela;
+
+namespace {
+
+bool refersTo(ast::Expression *expr, ast::Statement *definition) {
+  auto *ident = dynamic_cast<ast::Identifier *>(expr);
+  return ident && ident->definition == definition;
+}
+
+bool isInt(ast::Expression *expr, const Uint value) {
+  auto *num = dynamic_cast<ast::NumberLiteral *>(expr);
+  if (!num) {
+    return false;
+  }
+  if (auto *sint = std::get_if<Sint>(&num->value)) {
+    return *sint == static_cast<Sint>(value);
+  } else if (auto *uint = std::get_if<Uint>(&num->value)) {
+    return *uint == value;
+  } else {
+    return false;
+  }
+}
+
+/// The array of a condition like i < size(array) or i != size(array)
+ast::Statement *sizeOfArray(ast::Expression *cond, ast::Statement *index) {
+  auto *bin = dynamic_cast<ast::BinaryExpr *>(cond);
+  if (!bin || (bin->oper != ast::BinOp::lt && bin->oper != ast::BinOp::ne)) {
+    return nullptr;
+  }
+  if (!refersTo(bin->lhs.get(), index)) {
+    return nullptr;
+  }
+  auto *call = dynamic_cast<ast::FuncCall *>(bin->rhs.get());
+  if (!call || call->args.size() != 1) {
+    return nullptr;
+  }
+  auto *btn = dynamic_cast<ast::BtnFunc *>(call->definition);
+  if (!btn || btn->value != ast::BtnFuncEnum::size) {
+    return nullptr;
+  }
+  auto *array = dynamic_cast<ast::Identifier *>(call->args[0].get());
+  return array ? array->definition : nullptr;
+}
+
+/// Incrementing is lowered to i = i + 1 before this runs
+bool isIncrement(ast::Assignment *incr, ast::Statement *index) {
+  if (auto *incrDecr = dynamic_cast<ast::IncrDecr *>(incr)) {
+    return incrDecr->incr && refersTo(incrDecr->expr.get(), index);
+  }
+  auto *assign = dynamic_cast<ast::Assign *>(incr);
+  if (!assign || !refersTo(assign->dst.get(), index)) {
+    return false;
+  }
+  auto *add = dynamic_cast<ast::BinaryExpr *>(assign->src.get());
+  return add && add->oper == ast::BinOp::add &&
+         refersTo(add->lhs.get(), index) &&
+         isInt(add->rhs.get(), 1);
+}
+
+/// Whether an object of the type might hold an array of the target type.
+/// Arrays hold their elements through pointers so pointers are followed
+bool containsType(llvm::Type *type, llvm::Type *target, std::vector<llvm::Type *> &visited) {
+  if (type == target) {
+    return true;
+  }
+  if (std::find(visited.cbegin(), visited.cend(), type) != visited.cend()) {
+    return false;
+  }
+  visited.push_back(type);
+  for (llvm::Type *sub : type->subtypes()) {
+    if (containsType(sub, target, visited)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/// Looks for anything in the body of a loop that might modify the index or
+/// change the size of the array. Calls to functions are assumed to modify
+/// everything. An array of the same type or an object that holds one might
+/// be an alias of the array
+class BodyVisitor final : public ast::Visitor {
+public:
+  BodyVisitor(llvm::LLVMContext &ctx, ast::Statement *index, ast::Statement *array, llvm::Type *arrayTy)
+    : ctx{ctx}, index{index}, array{array}, arrayTy{arrayTy} {}
+  
+  std::vector<ast::Subscript *> subscripts;
+  bool modified = false;
+  
+  void visit(ast::Block &block) override {
+    for (const ast::StatPtr &stat : block.nodes) {
+      stat->accept(*this);
+    }
+  }
+  void visit(ast::If &fi) override {
+    fi.cond->accept(*this);
+    fi.body->accept(*this);
+    if (fi.elseBody) {
+      fi.elseBody->accept(*this);
+    }
+  }
+  void visit(ast::Switch &swich) override {
+    swich.expr->accept(*this);
+    for (ast::SwitchCase &cse : swich.cases) {
+      if (cse.expr) {
+        cse.expr->accept(*this);
+      }
+      cse.body->accept(*this);
+    }
+  }
+  void visit(ast::Return &ret) override {
+    if (ret.expr) {
+      ret.expr->accept(*this);
+    }
+  }
+  void visit(ast::While &wile) override {
+    wile.cond->accept(*this);
+    wile.body->accept(*this);
+  }
+  void visit(ast::For &four) override {
+    if (four.init) {
+      four.init->accept(*this);
+    }
+    four.cond->accept(*this);
+    if (four.incr) {
+      four.incr->accept(*this);
+    }
+    four.body->accept(*this);
+  }
+  
+  void visit(ast::Var &var) override {
+    if (var.expr) {
+      var.expr->accept(*this);
+    }
+  }
+  void visit(ast::Let &let) override {
+    if (let.expr) {
+      let.expr->accept(*this);
+    }
+  }
+  void visit(ast::DeclAssign &assign) override {
+    assign.expr->accept(*this);
+  }
+  void visit(ast::Assign &assign) override {
+    writeTo(assign.dst.get());
+    assign.dst->accept(*this);
+    assign.src->accept(*this);
+  }
+  void visit(ast::CompAssign &assign) override {
+    writeTo(assign.dst.get());
+    assign.dst->accept(*this);
+    assign.src->accept(*this);
+  }
+  void visit(ast::IncrDecr &incrDecr) override {
+    writeTo(incrDecr.expr.get());
+    incrDecr.expr->accept(*this);
+  }
+  void visit(ast::CallAssign &assign) override {
+    assign.call.accept(*this);
+  }
+  
+  void visit(ast::BinaryExpr &expr) override {
+    expr.lhs->accept(*this);
+    expr.rhs->accept(*this);
+  }
+  void visit(ast::UnaryExpr &expr) override {
+    expr.expr->accept(*this);
+  }
+  void visit(ast::FuncCall &call) override {
+    auto *btn = dynamic_cast<ast::BtnFunc *>(call.definition);
+    if (!btn) {
+      modified = true;
+      return;
+    }
+    if (btn->value != ast::BtnFuncEnum::capacity &&
+        btn->value != ast::BtnFuncEnum::size &&
+        btn->value != ast::BtnFuncEnum::data) {
+      writeTo(call.args[0].get());
+    }
+    for (const ast::ExprPtr &arg : call.args) {
+      arg->accept(*this);
+    }
+  }
+  void visit(ast::MemberIdent &mem) override {
+    mem.object->accept(*this);
+  }
+  void visit(ast::Subscript &sub) override {
+    if (refersTo(sub.object.get(), array) && refersTo(sub.index.get(), index)) {
+      subscripts.push_back(&sub);
+    }
+    sub.object->accept(*this);
+    sub.index->accept(*this);
+  }
+  void visit(ast::Ternary &tern) override {
+    tern.cond->accept(*this);
+    tern.troo->accept(*this);
+    tern.fols->accept(*this);
+  }
+  void visit(ast::Make &make) override {
+    make.expr->accept(*this);
+  }
+  void visit(ast::ArrayLiteral &arr) override {
+    for (const ast::ExprPtr &expr : arr.exprs) {
+      expr->accept(*this);
+    }
+  }
+  void visit(ast::InitList &list) override {
+    for (const ast::ExprPtr &expr : list.exprs) {
+      expr->accept(*this);
+    }
+  }
+
+private:
+  llvm::LLVMContext &ctx;
+  ast::Statement *index;
+  ast::Statement *array;
+  llvm::Type *arrayTy;
+  
+  void writeTo(ast::Expression *dst) {
+    std::vector<llvm::Type *> visited;
+    llvm::Type *dstTy = generateType(ctx, dst->exprType.get());
+    if (refersTo(dst, index) || containsType(dstTy, arrayTy, visited)) {
+      modified = true;
+    }
+  }
+};
+
+class Visitor final : public ast::Visitor {
+public:
+  explicit Visitor(llvm::LLVMContext &ctx)
+    : ctx{ctx} {}
+  
+  void visit(ast::Block &block) override {
+    for (const ast::StatPtr &stat : block.nodes) {
+      stat->accept(*this);
+    }
+  }
+  void visit(ast::If &fi) override {
+    fi.body->accept(*this);
+    if (fi.elseBody) {
+      fi.elseBody->accept(*this);
+    }
+  }
+  void visit(ast::Switch &swich) override {
+    for (ast::SwitchCase &cse : swich.cases) {
+      cse.body->accept(*this);
+    }
+  }
+  void visit(ast::While &wile) override {
+    wile.body->accept(*this);
+  }
+  void visit(ast::For &four) override {
+    markLoop(four);
+    four.body->accept(*this);
+  }
+
+private:
+  llvm::LLVMContext &ctx;
+  
+  void markLoop(ast::For &four) {
+    auto *index = dynamic_cast<ast::DeclAssign *>(four.init.get());
+    if (!index || !isInt(index->expr.get(), 0) || !four.cond || !four.incr) {
+      return;
+    }
+    ast::Statement *array = sizeOfArray(four.cond.get(), index);
+    if (!array || !isIncrement(four.incr.get(), index)) {
+      return;
+    }
+    // a reference might be an alias of anything, even an element of an array
+    // that is destroyed by the loop
+    auto *param = dynamic_cast<ast::FuncParam *>(array);
+    if (param && param->ref == ast::ParamRef::ref) {
+      return;
+    }
+    auto *size = assertDownCast<ast::BinaryExpr>(four.cond.get());
+    auto *call = assertDownCast<ast::FuncCall>(size->rhs.get());
+    llvm::Type *arrayTy = generateType(ctx, call->args[0]->exprType.get());
+    BodyVisitor body{ctx, index, array, arrayTy};
+    four.body->accept(body);
+    if (!body.modified) {
+      for (ast::Subscript *sub : body.subscripts) {
+        sub->inBounds = true;
+      }
+    }
+  }
+};
+
+}
+
+void stela::markInBounds(llvm::LLVMContext &ctx, ast::Block &block) {
+  Visitor visitor{ctx};
+  visitor.visit(block);
+}
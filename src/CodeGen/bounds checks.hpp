@@ -0,0 +1,30 @@
+//
+//  bounds checks.hpp
+//  STELA
+//
+//  Created by Indi Kernick on 18/10/26.
+//  Copyright © 2026 Indi Kernick. All rights reserved.
+//
+
+#ifndef stela_bounds_checks_hpp
+#define stela_bounds_checks_hpp
+
+#include "ast.hpp"
+
+namespace llvm {
+
+class LLVMContext;
+
+}
+
+namespace stela {
+
+/// Mark the subscripts that are always in bounds so that they are generated
+/// without a bounds check. These are the subscripts array[i] in the body of
+/// a loop like for (i := 0; i < size(array); i++) where the body cannot
+/// modify i or change the size of array
+void markInBounds(llvm::LLVMContext &, ast::Block &);
+
+}
+
+#endif
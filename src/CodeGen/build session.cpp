@@ -0,0 +1,260 @@
+//
+//  build session.cpp
+//  STELA
+//
+//  Created by Indi Kernick on 18/10/26.
+//  Copyright © 2026 Indi Kernick. All rights reserved.
+//
+
+#include "build session.hpp"
+
+#include <llvm/IR/Module.h>
+#include "syntax analysis.hpp"
+#include "Utils/algorithms.hpp"
+#include "semantic analysis.hpp"
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
+
+using namespace stela;
+
+struct stela::BuildSession::Module {
+  // tokens and names refer to the source so it must outlive everything else
+  std::string source;
+  size_t hash;
+  ast::Names imports;
+  sym::Scopes scopes;
+  sym::Scope *scope = nullptr;
+  ast::Decls decls;
+  llvm::ExecutionEngine *engine = nullptr;
+};
+
+namespace {
+
+Symbols initSymbols() {
+  NullSink sink;
+  return initModules(sink);
+}
+
+}
+
+stela::BuildSession::BuildSession(const OptFlags opt, llvm::ObjectCache *cache)
+  : syms{initSymbols()}, opt{opt}, cache{cache} {}
+
+stela::BuildSession::~BuildSession() {
+  for (auto &entry : modules) {
+    unload(*entry.second);
+  }
+}
+
+void stela::BuildSession::setSource(std::string source) {
+  pending.push_back(std::move(source));
+}
+
+void stela::BuildSession::remove(const std::string_view name) {
+  removed.emplace_back(name);
+}
+
+std::vector<std::string> stela::BuildSession::build(LogSink &sink) {
+  // a previous build may have failed part way through semantic analysis
+  syms.scopes.resize(1);
+  syms.decls.clear();
+  
+  // everything is parsed before any modules are touched so that a syntax
+  // error leaves the session as it was
+  std::vector<std::pair<std::unique_ptr<Module>, AST>> parsed;
+  for (const std::string &source : pending) {
+    auto module = std::make_unique<Module>();
+    module->source = source;
+    module->hash = std::hash<std::string>{}(source);
+    AST ast = createAST(module->source, sink);
+    module->imports = ast.imports;
+    parsed.emplace_back(std::move(module), std::move(ast));
+  }
+  pending.clear();
+  
+  for (const std::string &name : removed) {
+    const auto iter = modules.find(name);
+    if (iter != modules.end()) {
+      unload(*iter->second);
+      modules.erase(iter);
+    }
+  }
+  removed.clear();
+  
+  std::unordered_map<std::string, AST> asts;
+  for (auto &[module, ast] : parsed) {
+    std::unique_ptr<Module> &entry = modules[std::string{ast.name}];
+    if (entry && entry->hash == module->hash && entry->source == module->source) {
+      continue;
+    }
+    if (entry) {
+      unload(*entry);
+    }
+    entry = std::move(module);
+    asts.insert_or_assign(std::string{ast.name}, std::move(ast));
+  }
+  
+  // modules that haven't been built are out of date along with every module
+  // that imports an out of date module or a missing module
+  std::unordered_map<std::string, bool> dirty;
+  for (const auto &[name, module] : modules) {
+    dirty[name] = module->engine == nullptr;
+  }
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (const auto &[name, module] : modules) {
+      if (dirty[name]) {
+        continue;
+      }
+      for (const ast::Name &import : module->imports) {
+        const auto iter = dirty.find(std::string{import});
+        if (iter == dirty.end() || iter->second) {
+          dirty[name] = changed = true;
+          break;
+        }
+      }
+    }
+  }
+  
+  ast::Names clean;
+  ASTs order;
+  for (const auto &[name, module] : modules) {
+    if (!dirty[name]) {
+      clean.push_back(name);
+      continue;
+    }
+    const auto iter = asts.find(name);
+    if (iter != asts.end()) {
+      order.push_back(std::move(iter->second));
+    } else {
+      unload(*module);
+      order.push_back(createAST(module->source, sink));
+    }
+  }
+  
+  std::vector<std::string> names;
+  std::vector<size_t> scopeCounts;
+  for (const size_t index : findModuleOrder(order, clean, sink)) {
+    AST &ast = order[index];
+    names.emplace_back(ast.name);
+    Module &module = *modules.at(names.back());
+    
+    // the module can only see the modules that it imports
+    ast::Names imports;
+    collectImports(imports, module);
+    sym::Scope *scope = syms.scopes.front().get();
+    for (const ast::Name &import : imports) {
+      sym::Scope *next = modules.at(std::string{import})->scope;
+      next->parent = scope;
+      scope = next;
+    }
+    syms.global = scope;
+    
+    const size_t first = syms.scopes.size();
+    compileModuleUnchecked(syms, ast, sink);
+    module.scope = syms.scopes[first].get();
+    module.decls = std::move(syms.decls);
+    syms.decls.clear();
+    scopeCounts.push_back(syms.scopes.size() - first);
+  }
+  
+  if (names.empty()) {
+    return names;
+  }
+  // modules can only refer to symbols in modules that they import so every
+  // module that could refer to these symbols has just been compiled
+  checkUnused(syms, sink);
+  auto scope = syms.scopes.begin() + 1;
+  for (size_t n = 0; n != names.size(); ++n) {
+    sym::Scopes &scopes = modules.at(names[n])->scopes;
+    scopes.assign(
+      std::make_move_iterator(scope),
+      std::make_move_iterator(scope + scopeCounts[n])
+    );
+    scope += scopeCounts[n];
+  }
+  syms.scopes.resize(1);
+  
+  for (const std::string &name : names) {
+    generate(name, *modules.at(name), sink);
+  }
+  return names;
+}
+
+llvm::ExecutionEngine *stela::BuildSession::engine(const std::string_view name) const {
+  const auto iter = modules.find(std::string{name});
+  if (iter == modules.cend()) {
+    return nullptr;
+  }
+  return iter->second->engine;
+}
+
+void stela::BuildSession::unload(Module &module) {
+  if (module.engine) {
+    module.engine->runStaticConstructorsDestructors(true);
+    comp.destroyEngine(module.engine);
+    module.engine = nullptr;
+  }
+  module.decls.clear();
+  module.scopes.clear();
+  module.scope = nullptr;
+}
+
+void stela::BuildSession::collectImports(ast::Names &imports, const Module &module) const {
+  for (const ast::Name &name : module.imports) {
+    if (contains(imports, name)) {
+      continue;
+    }
+    const auto iter = modules.find(std::string{name});
+    if (iter != modules.cend()) {
+      collectImports(imports, *iter->second);
+      imports.push_back(name);
+    }
+  }
+}
+
+void stela::BuildSession::exportSymbols(const std::string &name, Module &module) {
+  // Internal symbols are prefixed with the module name so that importers can
+  // declare them without clashing with their own symbols
+  for (const ast::DeclPtr &decl : module.decls) {
+    llvm::GlobalValue *value = nullptr;
+    if (auto *func = dynamic_cast<ast::Func *>(decl.get())) {
+      if (!func->external) {
+        value = func->llvmFunc;
+      }
+    } else if (auto *var = dynamic_cast<ast::Var *>(decl.get())) {
+      if (!var->external) {
+        value = llvm::cast<llvm::GlobalValue>(var->llvmAddr);
+      }
+    } else if (auto *let = dynamic_cast<ast::Let *>(decl.get())) {
+      if (!let->external) {
+        value = llvm::cast<llvm::GlobalValue>(let->llvmAddr);
+      }
+    }
+    if (value) {
+      value->setName(llvm::Twine{name} + "." + value->getName());
+      value->setLinkage(llvm::GlobalValue::ExternalLinkage);
+    }
+  }
+}
+
+void stela::BuildSession::generate(const std::string &name, Module &module, LogSink &sink) {
+  std::unique_ptr<llvm::Module> ir = generateIR(comp, module.decls, sink, nullptr, opt);
+  exportSymbols(name, module);
+  
+  ast::Names imports;
+  collectImports(imports, module);
+  EngineOpts opts;
+  opts.opt = opt;
+  opts.cache = cache;
+  opts.findSymbol = [this, imports = std::move(imports)](const std::string &symbol) {
+    for (const ast::Name &import : imports) {
+      llvm::ExecutionEngine *engine = modules.at(std::string{import})->engine;
+      if (const uint64_t addr = engine->getGlobalValueAddress(symbol)) {
+        return addr;
+      }
+    }
+    return uint64_t{};
+  };
+  module.engine = generateCode(comp, std::move(ir), sink, opts);
+}
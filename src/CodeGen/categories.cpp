@@ -72,6 +72,8 @@ public:
   void visit(ast::Identifier &ident) override {
     if (dynamic_cast<ast::Func *>(ident.definition)) {
       cat = ValueCat::prvalue;
+    } else if (ident.lastUse) {
+      cat = ValueCat::xvalue;
     } else {
       cat = ValueCat::lvalue;
     }
@@ -9,23 +9,55 @@
 #include "code generation.hpp"
 
 #include "llvm.hpp"
+#include "profile.hpp"
+#include "lazy engine.hpp"
+#include "eager engine.hpp"
 #include "generate decl.hpp"
+#include "tiered engine.hpp"
 #include "Log/log output.hpp"
 #include <llvm/IR/Verifier.h>
-#include "optimize module.hpp"
-#include <llvm/ExecutionEngine/MCJIT.h>
+#include "parallel engine.hpp"
+#include "target machine.hpp"
+#include "Utils/phase timer.hpp"
+#include <llvm/Target/TargetMachine.h>
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
 
-std::unique_ptr<llvm::Module> stela::generateIR(const Symbols &syms, LogSink &sink) {
+using namespace stela;
+
+std::unique_ptr<llvm::Module> stela::generateIR(
+  CompileCtx &comp,
+  const Symbols &syms,
+  LogSink &sink,
+  CompileStats *stats,
+  const OptFlags opt
+) {
+  return generateIR(comp, syms.decls, sink, stats, opt);
+}
+
+std::unique_ptr<llvm::Module> stela::generateIR(
+  CompileCtx &comp,
+  const ast::Decls &decls,
+  LogSink &sink,
+  CompileStats *stats,
+  const OptFlags opt
+) {
+  PhaseTimer timer{stats, &CompileStats::generate};
   Log log{sink, LogCat::generate};
   log.status() << "Generating code" << endlog;
   
-  auto module = std::make_unique<llvm::Module>("", getLLVM());
-  // @TODO how do we get the native target machine object?
-  // module->setTargetTriple(machine->getTargetTriple().str());
-  // module->setDataLayout(machine->createDataLayout());
-  FuncInst inst{module.get()};
-  gen::Ctx ctx {module->getContext(), module.get(), inst, log};
-  generateDecl(ctx, module.get(), syms.decls);
+  auto module = std::make_unique<llvm::Module>("", comp.llvm());
+  // the sizes of runtime objects depend on the data layout. The engines
+  // retarget the module if they are given a different CPU
+  const std::unique_ptr<llvm::TargetMachine> machine = makeHostMachine(opt_all, log);
+  module->setTargetTriple(machine->getTargetTriple().str());
+  module->setDataLayout(machine->createDataLayout());
+  FuncInst &inst = comp.resetInst(module.get(), opt.allocator, opt.atomicRefCounts);
+  if (opt.allocator) {
+    markHostAddresses(*module);
+  }
+  gen::Ctx ctx {module->getContext(), module.get(), inst, log, opt.boundsChecks};
+  generateDecl(ctx, module.get(), decls);
+  setTarget(*module, *machine);
   
   std::string str;
   llvm::raw_string_ostream strStream(str);
@@ -33,40 +65,39 @@ std::unique_ptr<llvm::Module> stela::generateIR(const Symbols &syms, LogSink &si
     strStream.flush();
     log.error() << str << fatal;
   }
+  if (stats) {
+    stats->instsGenerated += module->getInstructionCount();
+  }
   
   return module;
 }
 
-namespace {
-
-llvm::CodeGenOpt::Level codeGenOpt(const bool optimize) {
-  return optimize ? llvm::CodeGenOpt::Aggressive : llvm::CodeGenOpt::None;
-}
-
-}
-
 llvm::ExecutionEngine *stela::generateCode(
+  CompileCtx &comp,
   std::unique_ptr<llvm::Module> module,
   LogSink &sink,
-  const OptFlags opt
+  const EngineOpts &opts
 ) {
   Log log{sink, LogCat::generate};
-  
-  std::string str;
-  llvm::Module *modulePtr = module.get();
-  auto engine = llvm::EngineBuilder(std::move(module))
-                .setErrorStr(&str)
-                .setOptLevel(codeGenOpt(opt.optimizeASM))
-                .setEngineKind(llvm::EngineKind::JIT)
-                .create();
-  if (engine == nullptr) {
-    log.error() << str << fatal;
+  checkProfile(opts.opt, log);
+  if (opts.opt.instrument && (opts.backend != Backend::eager || opts.threads > 1)) {
+    log.error() << "Instrumentation requires the eager backend with one thread" << fatal;
+  }
+  if (opts.opt.profile && opts.backend == Backend::eager && opts.threads > 1) {
+    log.error() << "Profiles require one thread because the parallel backend renames internal functions" << fatal;
   }
   
-  if (opt.optimizeIR) {
-    optimizeModule(engine->getTargetMachine(), modulePtr, opt);
+  llvm::ExecutionEngine *engine;
+  if (opts.backend == Backend::lazy) {
+    engine = generateLazy(std::move(module), log, opts.opt);
+  } else if (opts.backend == Backend::tiered) {
+    engine = generateTiered(std::move(module), log, opts);
+  } else if (opts.threads > 1) {
+    engine = generateParallel(std::move(module), log, opts);
+  } else {
+    engine = generateEager(std::move(module), log, opts);
   }
-  engine->finalizeObject();
+  comp.addEngine(engine);
   
   // @TODO don't forget to call destructors
   engine->runStaticConstructorsDestructors(false);
@@ -75,9 +106,10 @@ llvm::ExecutionEngine *stela::generateCode(
 }
 
 llvm::ExecutionEngine *stela::generateCode(
+  CompileCtx &comp,
   const Symbols &syms,
   LogSink &sink,
-  const OptFlags flags
+  const EngineOpts &opts
 ) {
-  return generateCode(generateIR(syms, sink), sink, flags);
+  return generateCode(comp, generateIR(comp, syms, sink, opts.stats, opts.opt), sink, opts);
 }
@@ -0,0 +1,173 @@
+//
+//  eager engine.cpp
+//  STELA
+//
+//  Created by Indi Kernick on 18/10/26.
+//  Copyright © 2026 Indi Kernick. All rights reserved.
+//
+
+#include "eager engine.hpp"
+
+#include <optional>
+#include "object cache.hpp"
+#include "Log/log output.hpp"
+#include "target machine.hpp"
+#include "optimize module.hpp"
+#include "Utils/phase timer.hpp"
+#include <llvm/ExecutionEngine/MCJIT.h>
+#include <llvm/ExecutionEngine/SectionMemoryManager.h>
+#include <llvm/ExecutionEngine/RTDyldMemoryManager.h>
+
+using namespace stela;
+
+namespace {
+
+/// Resolves the undefined symbols of a module with EngineOpts::findSymbol
+class HookResolver final : public llvm::LegacyJITSymbolResolver {
+public:
+  explicit HookResolver(std::function<uint64_t(const std::string &)> hook)
+    : hook{std::move(hook)} {}
+  
+  llvm::JITSymbol findSymbol(const std::string &name) override {
+    llvm::StringRef str = name;
+    if (prefix != '\0' && !str.empty() && str.front() == prefix) {
+      str = str.drop_front();
+    }
+    uint64_t addr = hook(str.str());
+    if (addr == 0) {
+      addr = llvm::RTDyldMemoryManager::getSymbolAddressInProcess(name);
+    }
+    if (addr == 0) {
+      return nullptr;
+    }
+    return {addr, llvm::JITSymbolFlags::Exported};
+  }
+  llvm::JITSymbol findSymbolInLogicalDylib(const std::string &) override {
+    return nullptr;
+  }
+  
+  // the prefix is known once the engine has selected a target
+  char prefix = '\0';
+
+private:
+  std::function<uint64_t(const std::string &)> hook;
+};
+
+/// Looks up the object of a module once and gives the result to the engine.
+/// The engine agrees with the decision to skip optimization even if the
+/// object is evicted or replaced after the lookup
+class SingleLookup final : public llvm::ObjectCache {
+public:
+  SingleLookup(llvm::ObjectCache &cache, const llvm::Module *module)
+    : cache{cache}, object{cache.getObject(module)}, found{object != nullptr} {}
+  
+  bool hit() const {
+    return found;
+  }
+  
+  void notifyObjectCompiled(const llvm::Module *module, llvm::MemoryBufferRef obj) override {
+    cache.notifyObjectCompiled(module, obj);
+  }
+  std::unique_ptr<llvm::MemoryBuffer> getObject(const llvm::Module *) override {
+    return std::move(object);
+  }
+
+private:
+  llvm::ObjectCache &cache;
+  std::unique_ptr<llvm::MemoryBuffer> object;
+  bool found;
+};
+
+/// Counts the bytes of machine code loaded into the engine
+class CountingMemoryManager final : public llvm::SectionMemoryManager {
+public:
+  explicit CountingMemoryManager(size_t &bytes)
+    : bytes{bytes} {}
+  
+  uint8_t *allocateCodeSection(
+    const uintptr_t size,
+    const unsigned align,
+    const unsigned id,
+    const llvm::StringRef name
+  ) override {
+    bytes += size;
+    return llvm::SectionMemoryManager::allocateCodeSection(size, align, id, name);
+  }
+
+private:
+  size_t &bytes;
+};
+
+}
+
+llvm::ExecutionEngine *stela::generateEager(
+  std::unique_ptr<llvm::Module> module,
+  Log &log,
+  const EngineOpts &opts
+) {
+  const OptFlags opt = opts.opt;
+  
+  // The key is computed from the unoptimized IR so that a cache hit can skip
+  // optimizeModule as well as machine code generation
+  std::optional<SingleLookup> cache;
+  bool cached = false;
+  if (opts.cache) {
+    module->setModuleIdentifier(moduleKey(*module, opt));
+    cache.emplace(*opts.cache, module.get());
+    cached = cache->hit();
+    if (cached) {
+      log.status() << "Loading machine code from cache" << endlog;
+    }
+  }
+  
+  std::string str;
+  llvm::Module *modulePtr = module.get();
+  llvm::EngineBuilder builder{std::move(module)};
+  if (opts.stats) {
+    // this sets the resolver as well so it must come first
+    builder.setMCJITMemoryManager(
+      std::make_unique<CountingMemoryManager>(opts.stats->machineBytes)
+    );
+  }
+  HookResolver *resolver = nullptr;
+  if (opts.findSymbol) {
+    auto owned = std::make_unique<HookResolver>(opts.findSymbol);
+    resolver = owned.get();
+    builder.setSymbolResolver(std::move(owned));
+  }
+  auto engine = builder.setErrorStr(&str)
+                       .setOptLevel(codeGenOpt(opt))
+                       .setMCPU(targetCPU(opt))
+                       .setMAttrs(targetFeatures(opt))
+                       .setEngineKind(llvm::EngineKind::JIT)
+                       .create();
+  if (engine == nullptr) {
+    log.error() << str << fatal;
+  }
+  if (resolver) {
+    resolver->prefix = engine->getDataLayout().getGlobalPrefix();
+  }
+  setTarget(*modulePtr, *engine->getTargetMachine());
+  
+  if (cache) {
+    engine->setObjectCache(&*cache);
+  }
+  if (opt.optimizeIR && !cached) {
+    PhaseTimer timer{opts.stats, &CompileStats::optimize};
+    optimizeModule(engine->getTargetMachine(), modulePtr, opt, opts.timings);
+  }
+  if (opts.stats && !cached) {
+    opts.stats->instsOptimized += modulePtr->getInstructionCount();
+  }
+  {
+    PhaseTimer timer{opts.stats, &CompileStats::machine};
+    engine->finalizeObject();
+  }
+  if (cache) {
+    // the lookup is only valid for this module
+    engine->setObjectCache(nullptr);
+  }
+  
+  return engine;
+}
+
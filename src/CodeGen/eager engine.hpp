@@ -0,0 +1,24 @@
+//
+//  eager engine.hpp
+//  STELA
+//
+//  Created by Indi Kernick on 18/10/26.
+//  Copyright © 2026 Indi Kernick. All rights reserved.
+//
+
+#ifndef stela_eager_engine_hpp
+#define stela_eager_engine_hpp
+
+#include "code generation.hpp"
+
+namespace stela {
+
+class Log;
+
+/// Optimize the module and compile it with MCJIT. The static constructors are
+/// not called
+llvm::ExecutionEngine *generateEager(std::unique_ptr<llvm::Module>, Log &, const EngineOpts &);
+
+}
+
+#endif
@@ -13,8 +13,8 @@
 
 using namespace stela;
 
-FuncInst::FuncInst(llvm::Module *module)
-  : module{module} {
+FuncInst::FuncInst(llvm::Module *module, const Allocator *alloc, const bool atomicRefs)
+  : module{module}, alloc{alloc}, atomicRefs{atomicRefs} {
   fns.fill(nullptr);
   for (FuncMap &map : paramFns) {
     map.reserve(16);
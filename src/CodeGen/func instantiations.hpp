@@ -21,9 +21,11 @@ class Type;
 
 namespace stela {
 
+struct Allocator;
+
 class FuncInst {
 public:
-  explicit FuncInst(llvm::Module *);
+  FuncInst(llvm::Module *, const Allocator *, bool);
   
   template <FGI Fn>
   llvm::Function *get() {
@@ -48,11 +50,23 @@ public:
     }
   }
   
+  /// The allocator that generated code calls. Null if generated code calls
+  /// the pool allocator directly
+  const Allocator *allocator() const {
+    return alloc;
+  }
+  /// Whether reference counts are changed atomically
+  bool atomicRefCounts() const {
+    return atomicRefs;
+  }
+  
 private:
   // @TODO seriously, we need ast::Type uniquing
   using FuncMap = std::unordered_map<llvm::Type *, llvm::Function *>;
 
   llvm::Module *module;
+  const Allocator *alloc;
+  bool atomicRefs;
   std::array<llvm::Function *, static_cast<size_t>(FGI::count_)> fns;
   std::array<FuncMap, static_cast<size_t>(PFGI::count_)> paramFns;
   
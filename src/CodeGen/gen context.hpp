@@ -26,6 +26,8 @@ struct Ctx {
   llvm::Module *mod;
   FuncInst &inst;
   Log &log;
+  /// Subscripts that are not known to be in bounds are checked
+  bool boundsChecks;
 };
 
 }
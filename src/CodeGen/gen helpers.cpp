@@ -25,6 +25,14 @@ llvm::Attribute::AttrKind getInline(const Inline inl) {
   UNREACHABLE();
 }
 
+llvm::Value *byteSize(llvm::IRBuilder<> &ir, llvm::Type *type, llvm::Value *count) {
+  llvm::Type *sizeTy = getType<size_t>(type->getContext());
+  llvm::Constant *size64 = llvm::ConstantExpr::getSizeOf(type);
+  llvm::Constant *size = llvm::ConstantExpr::getIntegerCast(size64, sizeTy, false);
+  llvm::Value *numElems = ir.CreateIntCast(count, sizeTy, false);
+  return ir.CreateMul(size, numElems);
+}
+
 }
 
 llvm::Function *stela::makeInternalFunc(
@@ -59,6 +67,41 @@ llvm::Function *stela::declareCFunc(
   return func;
 }
 
+llvm::Function *stela::importFunc(llvm::Module *module, llvm::Function *func) {
+  if (func->getParent() == module) {
+    return func;
+  }
+  if (llvm::Function *decl = module->getFunction(func->getName())) {
+    return decl;
+  }
+  llvm::Function *decl = llvm::Function::Create(
+    func->getFunctionType(),
+    llvm::Function::ExternalLinkage,
+    func->getName(),
+    module
+  );
+  decl->setAttributes(func->getAttributes());
+  return decl;
+}
+
+llvm::Value *stela::importGlobal(llvm::Module *module, llvm::Value *value) {
+  auto *global = llvm::dyn_cast<llvm::GlobalVariable>(value);
+  if (global == nullptr || global->getParent() == module) {
+    return value;
+  }
+  if (llvm::GlobalVariable *decl = module->getNamedGlobal(global->getName())) {
+    return decl;
+  }
+  return new llvm::GlobalVariable{
+    *module,
+    global->getValueType(),
+    global->isConstant(),
+    llvm::GlobalVariable::ExternalLinkage,
+    nullptr,
+    global->getName()
+  };
+}
+
 llvm::FunctionType *stela::unaryCtorFor(llvm::Type *type) {
   return llvm::FunctionType::get(
     voidTy(type->getContext()),
@@ -121,6 +164,14 @@ void stela::assignBoolAttrs(llvm::Function *func) {
   func->addAttribute(0, llvm::Attribute::ZExt);
 }
 
+uint32_t stela::hashString(const std::string_view str) {
+  uint32_t hash = fnv_basis;
+  for (const char c : str) {
+    hash = (hash ^ static_cast<uint8_t>(c)) * fnv_prime;
+  }
+  return hash;
+}
+
 llvm::Constant *stela::constantFor(llvm::Type *type, const uint64_t value) {
   return llvm::ConstantInt::get(type, value);
 }
@@ -137,6 +188,12 @@ llvm::Value *stela::loadStructElem(llvm::IRBuilder<> &ir, llvm::Value *srtPtr, u
   return ir.CreateLoad(ir.CreateStructGEP(srtPtr, idx));
 }
 
+llvm::Value *stela::loadAtomicRef(llvm::IRBuilder<> &ir, llvm::Value *ptr, const llvm::AtomicOrdering order) {
+  llvm::LoadInst *load = ir.CreateAlignedLoad(ptr, alignof(uint64_t));
+  load->setAtomic(order);
+  return load;
+}
+
 llvm::Value *stela::arrayIndex(llvm::IRBuilder<> &ir, llvm::Value *ptr, llvm::Value *idx) {
   llvm::Type *sizeTy = getType<size_t>(ir.getContext());
   llvm::Value *wideIdx = ir.CreateIntCast(idx, sizeTy, false);
@@ -168,13 +225,7 @@ void stela::callPanic(llvm::IRBuilder<> &ir, llvm::Function *panic, std::string_
 }
 
 llvm::Value *stela::callAlloc(llvm::IRBuilder<> &ir, llvm::Function *alloc, llvm::Type *type, llvm::Value *count) {
-  llvm::LLVMContext &ctx = alloc->getContext();
-  llvm::Type *sizeTy = getType<size_t>(ctx);
-  llvm::Constant *size64 = llvm::ConstantExpr::getSizeOf(type);
-  llvm::Constant *size = llvm::ConstantExpr::getIntegerCast(size64, sizeTy, false);
-  llvm::Value *numElems = ir.CreateIntCast(count, sizeTy, false);
-  llvm::Value *bytes = ir.CreateMul(size, numElems);
-  llvm::Value *memPtr = ir.CreateCall(alloc, {bytes});
+  llvm::Value *memPtr = ir.CreateCall(alloc, {byteSize(ir, type, count)});
   return ir.CreatePointerCast(memPtr, type->getPointerTo());
 }
 
@@ -187,6 +238,28 @@ void stela::callFree(llvm::IRBuilder<> &ir, llvm::Function *free, llvm::Value *p
   ir.CreateCall(free, ir.CreatePointerCast(ptr, voidPtrTy(ptr->getContext())));
 }
 
+llvm::Value *stela::callRealloc(llvm::IRBuilder<> &ir, llvm::Function *realloc, llvm::Value *ptr, llvm::Value *count) {
+  llvm::Type *type = ptr->getType()->getPointerElementType();
+  llvm::Value *memPtr = ir.CreatePointerCast(ptr, voidPtrTy(ptr->getContext()));
+  llvm::Value *newPtr = ir.CreateCall(realloc, {memPtr, byteSize(ir, type, count)});
+  return ir.CreatePointerCast(newPtr, ptr->getType());
+}
+
+llvm::Value *stela::callAllocStorage(llvm::IRBuilder<> &ir, llvm::Function *alloc, llvm::Type *storageTy, llvm::Value *count) {
+  llvm::Type *sizeTy = getType<size_t>(alloc->getContext());
+  llvm::Type *elemTy = storageTy->getStructElementType(array_idx_dat)->getPointerElementType();
+  llvm::Value *headerSize = byteSize(ir, storageTy, constantFor(sizeTy, 1));
+  llvm::Value *size = ir.CreateAdd(headerSize, byteSize(ir, elemTy, count));
+  llvm::Value *memPtr = ir.CreateCall(alloc, {size});
+  return ir.CreatePointerCast(memPtr, storageTy->getPointerTo());
+}
+
+llvm::Value *stela::inlineDat(llvm::IRBuilder<> &ir, llvm::Value *storage) {
+  llvm::Type *storageTy = storage->getType()->getPointerElementType();
+  llvm::Type *datTy = storageTy->getStructElementType(array_idx_dat);
+  return ir.CreatePointerCast(ir.CreateConstInBoundsGEP1_64(storage, 1), datTy);
+}
+
 gen::Expr stela::lvalue(llvm::Value *obj) {
   return {obj, ValueCat::lvalue};
 }
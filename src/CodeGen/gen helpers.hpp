@@ -19,6 +19,9 @@ constexpr unsigned array_idx_cap = 1;
 constexpr unsigned array_idx_len = 2;
 constexpr unsigned array_idx_dat = 3;
 
+constexpr uint32_t fnv_basis = 2166136261u;
+constexpr uint32_t fnv_prime = 16777619u;
+
 enum class Inline {
   never,
   smart,
@@ -33,6 +36,11 @@ llvm::Function *makeInternalFunc(
   Inline = Inline::always
 );
 llvm::Function *declareCFunc(llvm::Module *, llvm::FunctionType *, const llvm::Twine &);
+/// Declare a function that is defined in another module
+llvm::Function *importFunc(llvm::Module *, llvm::Function *);
+/// Declare a global variable that is defined in another module. Values that
+/// are not global variables are returned unchanged
+llvm::Value *importGlobal(llvm::Module *, llvm::Value *);
 
 llvm::FunctionType *unaryCtorFor(llvm::Type *);
 llvm::FunctionType *binaryCtorFor(llvm::Type *);
@@ -45,11 +53,16 @@ void assignBinaryCtorAttrs(llvm::Function *);
 void assignCompareAttrs(llvm::Function *);
 void assignBoolAttrs(llvm::Function *);
 
+/// FNV-1a hash of a string. arr_hash computes the same hash at runtime
+uint32_t hashString(std::string_view);
+
 llvm::Constant *constantFor(llvm::Type *, uint64_t);
 llvm::Constant *constantFor(llvm::Value *, uint64_t);
 llvm::Constant *constantForPtr(llvm::Value *, uint64_t);
 
 llvm::Value *loadStructElem(llvm::IRBuilder<> &, llvm::Value *, unsigned);
+/// Load a reference count that might be changed by other threads
+llvm::Value *loadAtomicRef(llvm::IRBuilder<> &, llvm::Value *, llvm::AtomicOrdering);
 llvm::Value *arrayIndex(llvm::IRBuilder<> &, llvm::Value *, llvm::Value *);
 void setNull(llvm::IRBuilder<> &, llvm::Value *);
 void likely(llvm::BranchInst *);
@@ -58,6 +71,14 @@ void callPanic(llvm::IRBuilder<> &, llvm::Function *, std::string_view);
 llvm::Value *callAlloc(llvm::IRBuilder<> &, llvm::Function *, llvm::Type *, llvm::Value *);
 llvm::Value *callAlloc(llvm::IRBuilder<> &, llvm::Function *, llvm::Type *);
 void callFree(llvm::IRBuilder<> &, llvm::Function *, llvm::Value *);
+/// Resize the memory of an array of the pointee type to the given number of
+/// elements
+llvm::Value *callRealloc(llvm::IRBuilder<> &, llvm::Function *, llvm::Value *, llvm::Value *);
+/// Allocate an array storage with room for the given number of elements
+/// after the header
+llvm::Value *callAllocStorage(llvm::IRBuilder<> &, llvm::Function *, llvm::Type *, llvm::Value *);
+/// The elements that are allocated in the same block as an array storage
+llvm::Value *inlineDat(llvm::IRBuilder<> &, llvm::Value *);
 
 gen::Expr lvalue(llvm::Value *);
 void returnBool(llvm::IRBuilder<> &, bool);
@@ -8,6 +8,7 @@
 
 #include "gen types.hpp"
 
+#include "native types.hpp"
 #include <llvm/IR/Constants.h>
 #include "Utils/unreachable.hpp"
 #include <llvm/IR/DerivedTypes.h>
@@ -51,7 +52,7 @@ llvm::IntegerType *stela::getSizedType(llvm::LLVMContext &ctx, const size_t size
 }
 
 llvm::IntegerType *stela::lenTy(llvm::LLVMContext &ctx) {
-  return llvm::Type::getInt32Ty(ctx);
+  return getType<Len>(ctx);
 }
 
 llvm::IntegerType *stela::refTy(llvm::LLVMContext &ctx) {
@@ -6,8 +6,10 @@
 //  Copyright © 2019 Indi Kernick. All rights reserved.
 //
 
+#include "number.hpp"
 #include "inst data.hpp"
 #include "gen types.hpp"
+#include "retain ptr.hpp"
 #include "gen helpers.hpp"
 #include "generate type.hpp"
 #include "compare exprs.hpp"
@@ -35,6 +37,38 @@ llvm::Function *stela::genFn<PFGI::arr_dtor>(InstData data, ast::ArrayType *arr)
   return func;
 }
 
+namespace {
+
+/// Storage that is shared by every empty array in the module. The storage is
+/// immortal so that constructing an empty array doesn't allocate. arr_own
+/// copies it before it is modified
+llvm::Constant *emptyStorage(llvm::Module *module, llvm::Type *type) {
+  llvm::GlobalVariable *storage = module->getNamedGlobal("arr_empty");
+  if (!storage) {
+    llvm::LLVMContext &ctx = module->getContext();
+    llvm::StructType *storageTy = arrayTy(llvm::Type::getInt8Ty(ctx));
+    llvm::Constant *zero = llvm::ConstantInt::get(lenTy(ctx), 0);
+    llvm::Constant *init = llvm::ConstantStruct::get(storageTy, {
+      llvm::ConstantInt::get(refTy(ctx), immortal_count),
+      zero,
+      zero,
+      nullPtr(voidPtrTy(ctx))
+    });
+    // the reference count is modified so the storage is not constant
+    storage = new llvm::GlobalVariable{
+      *module,
+      storageTy,
+      false,
+      llvm::GlobalVariable::PrivateLinkage,
+      init,
+      "arr_empty"
+    };
+  }
+  return llvm::ConstantExpr::getPointerCast(storage, type);
+}
+
+}
+
 template <>
 llvm::Function *stela::genFn<PFGI::arr_def_ctor>(InstData data, ast::ArrayType *arr) {
   llvm::Type *type = generateType(data.mod->getContext(), arr);
@@ -43,25 +77,10 @@ llvm::Function *stela::genFn<PFGI::arr_def_ctor>(InstData data, ast::ArrayType *
   FuncBuilder builder{func};
   
   /*
-  obj = malloc
-  obj.ref = 1
-  obj.cap = 0
-  obj.len = 0
-  obj.dat = null
+  obj = arr_empty
   */
   
-  llvm::Value *arrayPtr = func->arg_begin();
-  llvm::Type *storageTy = type->getPointerElementType();
-  llvm::Value *array = callAlloc(builder.ir, data.inst.get<FGI::alloc>(), storageTy);
-  initRefCount(builder.ir, array);
-
-  llvm::Value *cap = builder.ir.CreateStructGEP(array, array_idx_cap);
-  builder.ir.CreateStore(constantForPtr(cap, 0), cap);
-  llvm::Value *len = builder.ir.CreateStructGEP(array, array_idx_len);
-  builder.ir.CreateStore(constantForPtr(len, 0), len);
-  llvm::Value *dat = builder.ir.CreateStructGEP(array, array_idx_dat);
-  setNull(builder.ir, dat);
-  builder.ir.CreateStore(array, arrayPtr);
+  builder.ir.CreateStore(emptyStorage(data.mod, type), func->arg_begin());
   builder.ir.CreateRetVoid();
   
   return func;
@@ -153,15 +172,17 @@ llvm::Function *generateArrayIdx(
   InstData data,
   ast::ArrayType *arr,
   BoundsChecker *checkBounds,
+  const bool signedIdx,
   const llvm::Twine &name
 ) {
-  llvm::Type *type = generateType(data.mod->getContext(), arr);
+  llvm::LLVMContext &ctx = data.mod->getContext();
+  llvm::Type *type = generateType(ctx, arr);
   llvm::Type *arrayStruct = type->getPointerElementType();
   llvm::Type *elemPtr = arrayStruct->getStructElementType(array_idx_dat);
   llvm::Type *lenType = arrayStruct->getStructElementType(array_idx_len);
   llvm::FunctionType *fnType = llvm::FunctionType::get(
     elemPtr,
-    {type->getPointerTo(), lenType},
+    {type->getPointerTo(), getType<Uint>(ctx)},
     false
   );
   llvm::Function *func = makeInternalFunc(data.mod, fnType, name);
@@ -175,16 +196,24 @@ llvm::Function *generateArrayIdx(
     panic
   */
   
+  // the caller calls arr_own before an element is modified
+  llvm::Value *array = builder.ir.CreateLoad(func->arg_begin());
+  // indices are widened so that they can be compared to 64-bit lengths
+  llvm::Value *idx = builder.ir.CreateIntCast(func->arg_begin() + 1, lenType, signedIdx);
+  if (!checkBounds) {
+    llvm::Value *dat = loadStructElem(builder.ir, array, array_idx_dat);
+    builder.ir.CreateRet(arrayIndex(builder.ir, dat, idx));
+    return func;
+  }
   llvm::BasicBlock *okBlock = builder.makeBlock();
   llvm::BasicBlock *errorBlock = builder.makeBlock();
-  llvm::Value *array = builder.ir.CreateLoad(func->arg_begin());
   llvm::Value *len = loadStructElem(builder.ir, array, array_idx_len);
-  llvm::Value *inBounds = checkBounds(builder.ir, func->arg_begin() + 1, len);
+  llvm::Value *inBounds = checkBounds(builder.ir, idx, len);
   likely(builder.ir.CreateCondBr(inBounds, okBlock, errorBlock));
   
   builder.setCurr(okBlock);
   llvm::Value *dat = loadStructElem(builder.ir, array, array_idx_dat);
-  builder.ir.CreateRet(arrayIndex(builder.ir, dat, func->arg_begin() + 1));
+  builder.ir.CreateRet(arrayIndex(builder.ir, dat, idx));
   
   builder.setCurr(errorBlock);
   callPanic(builder.ir, data.inst.get<FGI::panic>(), "Index out of bounds");
@@ -206,12 +235,17 @@ llvm::Value *checkUnsignedBounds(llvm::IRBuilder<> &ir, llvm::Value *index, llvm
 
 template <>
 llvm::Function *stela::genFn<PFGI::arr_idx_s>(InstData data, ast::ArrayType *arr) {
-  return generateArrayIdx(data, arr, checkSignedBounds, "arr_idx_s");
+  return generateArrayIdx(data, arr, checkSignedBounds, true, "arr_idx_s");
 }
 
 template <>
 llvm::Function *stela::genFn<PFGI::arr_idx_u>(InstData data, ast::ArrayType *arr) {
-  return generateArrayIdx(data, arr, checkUnsignedBounds, "arr_idx_u");
+  return generateArrayIdx(data, arr, checkUnsignedBounds, false, "arr_idx_u");
+}
+
+template <>
+llvm::Function *stela::genFn<PFGI::arr_idx>(InstData data, ast::ArrayType *arr) {
+  return generateArrayIdx(data, arr, nullptr, false, "arr_idx");
 }
 
 template <>
@@ -220,7 +254,6 @@ llvm::Function *stela::genFn<PFGI::arr_len_ctor>(InstData data, ast::ArrayType *
   llvm::Type *type = generateType(ctx, arr);
   llvm::Type *arrayStructType = type->getPointerElementType();
   llvm::Type *elemPtr = arrayStructType->getStructElementType(array_idx_dat);
-  llvm::Type *elem = elemPtr->getPointerElementType();
   llvm::FunctionType *sig = llvm::FunctionType::get(
     elemPtr,
     {type->getPointerTo(), arrayStructType->getStructElementType(array_idx_len)},
@@ -231,17 +264,21 @@ llvm::Function *stela::genFn<PFGI::arr_len_ctor>(InstData data, ast::ArrayType *
   FuncBuilder builder{func};
   
   /*
-  obj = malloc
+  obj = malloc(header + size)
   obj.ref = 1
   obj.cap = size
   obj.len = size
-  obj.dat = malloc(size)
+  obj.dat = inline_dat(obj)
   */
   
+  // the elements are allocated after the header so that a new array is a
+  // single allocation. The elements are moved to their own memory when the
+  // array grows
   llvm::Value *objPtr = func->arg_begin();
   llvm::Value *size = func->arg_begin() + 1;
-  llvm::Type *storageTy = type->getPointerElementType();
-  llvm::Value *obj = callAlloc(builder.ir, data.inst.get<FGI::alloc>(), storageTy);
+  llvm::Value *obj = callAllocStorage(
+    builder.ir, data.inst.get<FGI::alloc>(), arrayStructType, size
+  );
   initRefCount(builder.ir, obj);
   
   llvm::Value *objCapPtr = builder.ir.CreateStructGEP(obj, array_idx_cap);
@@ -249,13 +286,63 @@ llvm::Function *stela::genFn<PFGI::arr_len_ctor>(InstData data, ast::ArrayType *
   llvm::Value *objLenPtr = builder.ir.CreateStructGEP(obj, array_idx_len);
   builder.ir.CreateStore(size, objLenPtr);
   llvm::Value *objDatPtr = builder.ir.CreateStructGEP(obj, array_idx_dat);
-  llvm::Value *dat = callAlloc(builder.ir, data.inst.get<FGI::alloc>(), elem, size);
+  llvm::Value *dat = inlineDat(builder.ir, obj);
   builder.ir.CreateStore(dat, objDatPtr);
   builder.ir.CreateStore(obj, objPtr);
   builder.ir.CreateRet(dat);
   
   return func;
 }
+  
+template <>
+llvm::Function *stela::genFn<PFGI::arr_own>(InstData data, ast::ArrayType *arr) {
+  llvm::LLVMContext &ctx = data.mod->getContext();
+  llvm::Type *type = generateType(ctx, arr);
+  llvm::FunctionType *sig = llvm::FunctionType::get(
+    type, {type->getPointerTo()}, false
+  );
+  llvm::Function *func = makeInternalFunc(data.mod, sig, "arr_own", Inline::hint);
+  assignUnaryCtorAttrs(func);
+  func->addAttribute(0, llvm::Attribute::NonNull);
+  FuncBuilder builder{func};
+  
+  /*
+  if obj.ref < immortal / 2
+    return obj
+  else
+    dat = arr_len_ctor(ptr, obj.len)
+    copy_n(obj.dat, obj.len, dat)
+    return *ptr
+  */
+  
+  llvm::BasicBlock *mortalBlock = builder.makeBlock();
+  llvm::BasicBlock *copyBlock = builder.makeBlock();
+  llvm::Value *objPtr = func->arg_begin();
+  llvm::Value *obj = builder.ir.CreateLoad(objPtr);
+  llvm::Value *refPtr = builder.ir.CreatePointerCast(obj, refPtrTy(ctx));
+  llvm::Value *ref;
+  if (data.inst.atomicRefCounts()) {
+    ref = loadAtomicRef(builder.ir, refPtr, llvm::AtomicOrdering::Monotonic);
+  } else {
+    ref = builder.ir.CreateLoad(refPtr);
+  }
+  llvm::Value *mortal = builder.ir.CreateICmpULT(ref, constantFor(ref, immortal_count / 2));
+  likely(builder.ir.CreateCondBr(mortal, mortalBlock, copyBlock));
+  
+  builder.setCurr(mortalBlock);
+  builder.ir.CreateRet(obj);
+  
+  builder.setCurr(copyBlock);
+  llvm::Value *len = loadStructElem(builder.ir, obj, array_idx_len);
+  llvm::Value *dat = loadStructElem(builder.ir, obj, array_idx_dat);
+  llvm::Function *ctor = data.inst.get<PFGI::arr_len_ctor>(arr);
+  llvm::Value *newDat = builder.ir.CreateCall(ctor, {objPtr, len});
+  llvm::Function *copy_n = data.inst.get<PFGI::copy_n>(arr->elem.get());
+  builder.ir.CreateCall(copy_n, {dat, len, newDat});
+  builder.ir.CreateRet(builder.ir.CreateLoad(objPtr));
+  
+  return func;
+}
 
 template <>
 llvm::Function *stela::genFn<PFGI::arr_strg_dtor>(InstData data, ast::ArrayType *arr) {
@@ -268,15 +355,25 @@ llvm::Function *stela::genFn<PFGI::arr_strg_dtor>(InstData data, ast::ArrayType
   
   /*
   destroy_n(obj.dat, obj.len)
-  free(storage.dat)
+  if obj.dat != inline_dat(obj)
+    free(obj.dat)
   */
   
+  llvm::BasicBlock *freeBlock = builder.makeBlock();
+  llvm::BasicBlock *doneBlock = builder.makeBlock();
   llvm::Value *obj = builder.ir.CreatePointerCast(func->arg_begin(), type);
   llvm::Value *objLen = loadStructElem(builder.ir, obj, array_idx_len);
   llvm::Value *objDat = loadStructElem(builder.ir, obj, array_idx_dat);
   llvm::Value *destroy_n = data.inst.get<PFGI::destroy_n>(arr->elem.get());
   builder.ir.CreateCall(destroy_n, {objDat, objLen});
+  llvm::Value *separate = builder.ir.CreateICmpNE(objDat, inlineDat(builder.ir, obj));
+  builder.ir.CreateCondBr(separate, freeBlock, doneBlock);
+  
+  builder.setCurr(freeBlock);
   callFree(builder.ir, data.inst.get<FGI::free>(), objDat);
+  builder.ir.CreateBr(doneBlock);
+  
+  builder.setCurr(doneBlock);
   builder.ir.CreateRetVoid();
   
   return func;
@@ -423,3 +520,55 @@ llvm::Function *stela::genFn<PFGI::arr_lt>(InstData data, ast::ArrayType *arr) {
   
   return func;
 }
+
+template <>
+llvm::Function *stela::genFn<PFGI::arr_hash>(InstData data, ast::ArrayType *arr) {
+  llvm::LLVMContext &ctx = data.mod->getContext();
+  llvm::Type *type = generateType(ctx, arr);
+  llvm::IntegerType *hashTy = llvm::IntegerType::getInt32Ty(ctx);
+  llvm::FunctionType *sig = llvm::FunctionType::get(
+    hashTy, {type->getPointerTo()}, false
+  );
+  llvm::Function *func = makeInternalFunc(data.mod, sig, "arr_hash", Inline::hint);
+  assignUnaryCtorAttrs(func);
+  func->addParamAttr(0, llvm::Attribute::ReadOnly);
+  func->addFnAttr(llvm::Attribute::ReadOnly);
+  FuncBuilder builder{func};
+  
+  /*
+  hash = fnv_basis
+  for elem in array
+    hash = (hash ^ elem) * fnv_prime
+  return hash
+  */
+  
+  llvm::BasicBlock *head = builder.makeBlock();
+  llvm::BasicBlock *body = builder.makeBlock();
+  llvm::BasicBlock *done = builder.makeBlock();
+  llvm::Value *array = builder.ir.CreateLoad(func->arg_begin());
+  llvm::Value *arrayDat = loadStructElem(builder.ir, array, array_idx_dat);
+  llvm::Value *arrayLen = loadStructElem(builder.ir, array, array_idx_len);
+  llvm::Value *arrayEnd = arrayIndex(builder.ir, arrayDat, arrayLen);
+  llvm::Value *elemPtr = builder.allocStore(arrayDat);
+  llvm::Value *hashPtr = builder.allocStore(llvm::ConstantInt::get(hashTy, fnv_basis));
+  builder.ir.CreateBr(head);
+  
+  builder.setCurr(head);
+  llvm::Value *elem = builder.ir.CreateLoad(elemPtr);
+  llvm::Value *atEnd = builder.ir.CreateICmpEQ(elem, arrayEnd);
+  builder.ir.CreateCondBr(atEnd, done, body);
+  
+  builder.setCurr(body);
+  llvm::Value *byte = builder.ir.CreateZExt(builder.ir.CreateLoad(elem), hashTy);
+  llvm::Value *mixed = builder.ir.CreateXor(builder.ir.CreateLoad(hashPtr), byte);
+  builder.ir.CreateStore(
+    builder.ir.CreateMul(mixed, llvm::ConstantInt::get(hashTy, fnv_prime)), hashPtr
+  );
+  builder.ir.CreateStore(builder.ir.CreateConstInBoundsGEP1_64(elem, 1), elemPtr);
+  builder.ir.CreateBr(head);
+  
+  builder.setCurr(done);
+  builder.ir.CreateRet(builder.ir.CreateLoad(hashPtr));
+  
+  return func;
+}
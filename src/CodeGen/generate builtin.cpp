@@ -6,6 +6,8 @@
 //  Copyright © 2019 Indi Kernick. All rights reserved.
 //
 
+#include <limits>
+#include "number.hpp"
 #include "gen types.hpp"
 #include "gen helpers.hpp"
 #include "generate type.hpp"
@@ -17,6 +19,11 @@ using namespace stela;
 
 namespace {
 
+/// Widen a length so that the size of the elements in bytes doesn't overflow
+llvm::Value *sizeOf(llvm::IRBuilder<> &ir, llvm::Value *len) {
+  return ir.CreateIntCast(len, getType<size_t>(ir.getContext()), false);
+}
+
 enum class IterType {
   construct,
   destroy
@@ -36,11 +43,11 @@ llvm::Function *iterImpl(InstData data, ast::Type *obj, IterType iterType) {
   if (classifyType(obj) == TypeCat::trivially_copyable) {
     if (iterType == IterType::construct) {
       llvm::Value *dat = func->arg_begin();
-      llvm::Value *len = func->arg_begin() + 1;
+      llvm::Value *len = sizeOf(builder.ir, func->arg_begin() + 1);
       llvm::DataLayout layout{data.mod};
       const unsigned align = layout.getPrefTypeAlignment(type);
       const uint64_t size = layout.getTypeAllocSize(type);
-      llvm::Value *byteLen = builder.ir.CreateNSWMul(len, constantFor(len, size));
+      llvm::Value *byteLen = builder.ir.CreateNUWMul(len, constantFor(len, size));
       builder.ir.CreateMemSet(dat, builder.ir.getInt8(0), byteLen, align);
     }
     builder.ir.CreateRetVoid();
@@ -132,12 +139,12 @@ llvm::Function *copyImpl(InstData data, ast::Type *obj, CopyType copyType) {
                       : (cat != TypeCat::nontrivial);
   if (fastCopy) {
     llvm::Value *src = func->arg_begin();
-    llvm::Value *len = func->arg_begin() + 1;
+    llvm::Value *len = sizeOf(builder.ir, func->arg_begin() + 1);
     llvm::Value *dst = func->arg_begin() + 2;
     llvm::DataLayout layout{data.mod};
     const unsigned align = layout.getPrefTypeAlignment(type);
     const uint64_t size = layout.getTypeAllocSize(type);
-    llvm::Value *byteLen = builder.ir.CreateNSWMul(len, constantFor(len, size));
+    llvm::Value *byteLen = builder.ir.CreateNUWMul(len, constantFor(len, size));
     builder.ir.CreateMemCpy(dst, align, src, align, byteLen);
     builder.ir.CreateRetVoid();
     return func;
@@ -221,28 +228,43 @@ llvm::Function *stela::genFn<PFGI::reallocate>(InstData data, ast::ArrayType *ar
   FuncBuilder builder{func};
   
   /*
-  newDat = malloc cap
-  move_n array.dat, array.len, newDat
-  free array.dat
-  array.dat = newDat
+  if array.dat == inline_dat(array)
+    newDat = malloc cap
+    move_n array.dat, array.len, newDat
+    array.dat = newDat
+  else
+    array.dat = realloc array.dat, cap
   array.cap = cap
   */
   
+  // objects can be moved by copying their bytes so the memory can be
+  // resized in place. Elements that are stored after the header are moved
+  // to their own memory
+  llvm::BasicBlock *inlineBlock = builder.makeBlock();
+  llvm::BasicBlock *reallocBlock = builder.makeBlock();
+  llvm::BasicBlock *doneBlock = builder.makeBlock();
   llvm::Value *array = func->arg_begin();
   llvm::Value *cap = func->arg_begin() + 1;
-  llvm::Type *storageTy = type->getPointerElementType();
-  llvm::Type *elemPtrTy = storageTy->getStructElementType(array_idx_dat);
-  llvm::Type *elemTy = elemPtrTy->getPointerElementType();
-  llvm::Value *newDat = callAlloc(
-    builder.ir, data.inst.get<FGI::alloc>(), elemTy, cap
-  );
-  llvm::Function *move_n = data.inst.get<PFGI::move_n>(arr->elem.get());
   llvm::Value *datPtr = builder.ir.CreateStructGEP(array, array_idx_dat);
   llvm::Value *dat = builder.ir.CreateLoad(datPtr);
+  llvm::Value *isInline = builder.ir.CreateICmpEQ(dat, inlineDat(builder.ir, array));
+  builder.ir.CreateCondBr(isInline, inlineBlock, reallocBlock);
+  
+  builder.setCurr(inlineBlock);
+  llvm::Type *elemTy = dat->getType()->getPointerElementType();
+  llvm::Value *newDat = callAlloc(builder.ir, data.inst.get<FGI::alloc>(), elemTy, cap);
+  llvm::Function *move_n = data.inst.get<PFGI::move_n>(arr->elem.get());
   llvm::Value *len = loadStructElem(builder.ir, array, array_idx_len);
   builder.ir.CreateCall(move_n, {dat, len, newDat});
-  callFree(builder.ir, data.inst.get<FGI::free>(), dat);
   builder.ir.CreateStore(newDat, datPtr);
+  builder.ir.CreateBr(doneBlock);
+  
+  builder.setCurr(reallocBlock);
+  llvm::Function *realloc = data.inst.get<FGI::realloc>();
+  builder.ir.CreateStore(callRealloc(builder.ir, realloc, dat, cap), datPtr);
+  builder.ir.CreateBr(doneBlock);
+  
+  builder.setCurr(doneBlock);
   llvm::Value *capPtr = builder.ir.CreateStructGEP(array, array_idx_cap);
   builder.ir.CreateStore(cap, capPtr);
   builder.ir.CreateRetVoid();
@@ -250,23 +272,48 @@ llvm::Function *stela::genFn<PFGI::reallocate>(InstData data, ast::ArrayType *ar
   return func;
 }
 
+namespace {
+
+/// Convert a length to the uint that scripts see. A length that doesn't fit
+/// is a panic. This can only happen with 64-bit lengths
+llvm::Value *lenToUint(InstData data, FuncBuilder &builder, llvm::Value *len) {
+  llvm::IntegerType *uintTy = getType<Uint>(len->getContext());
+  if (len->getType() == uintTy) {
+    return len;
+  }
+  llvm::BasicBlock *okBlock = builder.makeBlock();
+  llvm::BasicBlock *errorBlock = builder.makeBlock();
+  llvm::Value *max = constantFor(len, std::numeric_limits<Uint>::max());
+  llvm::Value *fits = builder.ir.CreateICmpULE(len, max);
+  likely(builder.ir.CreateCondBr(fits, okBlock, errorBlock));
+  
+  builder.setCurr(errorBlock);
+  callPanic(builder.ir, data.inst.get<FGI::panic>(), "Array length doesn't fit in uint");
+  
+  builder.setCurr(okBlock);
+  return builder.ir.CreateTrunc(len, uintTy);
+}
+
+}
+
 template <>
 llvm::Function *stela::genFn<PFGI::btn_capacity>(InstData data, ast::ArrayType *arr) {
   llvm::LLVMContext &ctx = data.mod->getContext();
   llvm::Type *type = generateType(ctx, arr);
   llvm::FunctionType *sig = llvm::FunctionType::get(
-    lenTy(ctx), {type->getPointerTo()}, false
+    getType<Uint>(ctx), {type->getPointerTo()}, false
   );
   llvm::Function *func = makeInternalFunc(data.mod, sig, "btn_capacity");
   assignUnaryCtorAttrs(func);
   FuncBuilder builder{func};
   
   /*
-  return array.cap
+  return (uint)array.cap
   */
   
   llvm::Value *array = builder.ir.CreateLoad(func->arg_begin());
-  builder.ir.CreateRet(loadStructElem(builder.ir, array, array_idx_cap));
+  llvm::Value *cap = loadStructElem(builder.ir, array, array_idx_cap);
+  builder.ir.CreateRet(lenToUint(data, builder, cap));
   
   return func;
 }
@@ -276,18 +323,19 @@ llvm::Function *stela::genFn<PFGI::btn_size>(InstData data, ast::ArrayType *arr)
   llvm::LLVMContext &ctx = data.mod->getContext();
   llvm::Type *type = generateType(ctx, arr);
   llvm::FunctionType *sig = llvm::FunctionType::get(
-    lenTy(ctx), {type->getPointerTo()}, false
+    getType<Uint>(ctx), {type->getPointerTo()}, false
   );
   llvm::Function *func = makeInternalFunc(data.mod, sig, "btn_size");
   assignUnaryCtorAttrs(func);
   FuncBuilder builder{func};
   
   /*
-  return array.len
+  return (uint)array.len
   */
   
   llvm::Value *array = builder.ir.CreateLoad(func->arg_begin());
-  builder.ir.CreateRet(loadStructElem(builder.ir, array, array_idx_len));
+  llvm::Value *len = loadStructElem(builder.ir, array, array_idx_len);
+  builder.ir.CreateRet(lenToUint(data, builder, len));
   
   return func;
 }
@@ -304,10 +352,12 @@ llvm::Function *stela::genFn<PFGI::btn_data>(InstData data, ast::ArrayType *arr)
   FuncBuilder builder{func};
   
   /*
+  arr_own(array)
   return (void *)array.dat
   */
   
-  llvm::Value *array = builder.ir.CreateLoad(func->arg_begin());
+  llvm::Function *own = data.inst.get<PFGI::arr_own>(arr);
+  llvm::Value *array = builder.ir.CreateCall(own, func->arg_begin());
   llvm::Value *arrayDat = loadStructElem(builder.ir, array, array_idx_dat);
   builder.ir.CreateRet(builder.ir.CreatePointerCast(arrayDat, voidPtrTy(ctx)));
   
@@ -327,6 +377,7 @@ llvm::Function *stela::genFn<PFGI::btn_push_back>(InstData data, ast::ArrayType
   FuncBuilder builder{func};
   
   /*
+  arr_own(array)
   if array.len == array.cap
     reallocate(array, ceil_to_pow_2(array.len + 1))
     continue
@@ -339,7 +390,8 @@ llvm::Function *stela::genFn<PFGI::btn_push_back>(InstData data, ast::ArrayType
   
   llvm::BasicBlock *reallocBlock = builder.makeBlock();
   llvm::BasicBlock *copyBlock = builder.makeBlock();
-  llvm::Value *array = builder.ir.CreateLoad(func->arg_begin());
+  llvm::Function *own = data.inst.get<PFGI::arr_own>(arr);
+  llvm::Value *array = builder.ir.CreateCall(own, func->arg_begin());
   llvm::Value *value = func->arg_begin() + 1;
   llvm::Value *arrayLenPtr = builder.ir.CreateStructGEP(array, array_idx_len);
   llvm::Value *arrayLen = builder.ir.CreateLoad(arrayLenPtr);
@@ -383,6 +435,7 @@ llvm::Function *stela::genFn<PFGI::btn_append>(InstData data, ast::ArrayType *ar
   FuncBuilder builder{func};
   
   /*
+  arr_own(array)
   if array.len + other.len > array.cap
     reallocate(array, ceil_to_pow_2(array.len + other.len))
     continue
@@ -395,7 +448,8 @@ llvm::Function *stela::genFn<PFGI::btn_append>(InstData data, ast::ArrayType *ar
   
   llvm::BasicBlock *reallocBlock = builder.makeBlock();
   llvm::BasicBlock *copyBlock = builder.makeBlock();
-  llvm::Value *array = builder.ir.CreateLoad(func->arg_begin());
+  llvm::Function *own = data.inst.get<PFGI::arr_own>(arr);
+  llvm::Value *array = builder.ir.CreateCall(own, func->arg_begin());
   llvm::Value *other = builder.ir.CreateLoad(func->arg_begin() + 1);
   llvm::Value *arrayLenPtr = builder.ir.CreateStructGEP(array, array_idx_len);
   llvm::Value *arrayLen = builder.ir.CreateLoad(arrayLenPtr);
@@ -436,6 +490,7 @@ llvm::Function *stela::genFn<PFGI::btn_pop_back>(InstData data, ast::ArrayType *
   FuncBuilder builder{func};
   
   /*
+  arr_own(array)
   if array.len != 0
     array.len--
     destroy array.dat[array.len]
@@ -446,7 +501,8 @@ llvm::Function *stela::genFn<PFGI::btn_pop_back>(InstData data, ast::ArrayType *
   
   llvm::BasicBlock *popBlock = builder.makeBlock();
   llvm::BasicBlock *panicBlock = builder.makeBlock();
-  llvm::Value *array = builder.ir.CreateLoad(func->arg_begin());
+  llvm::Function *own = data.inst.get<PFGI::arr_own>(arr);
+  llvm::Value *array = builder.ir.CreateCall(own, func->arg_begin());
   llvm::Value *lenPtr = builder.ir.CreateStructGEP(array, array_idx_len);
   llvm::Value *len = builder.ir.CreateLoad(lenPtr);
   llvm::Value *notEmpty = builder.ir.CreateICmpNE(len, constantFor(len, 0));
@@ -471,13 +527,14 @@ llvm::Function *stela::genFn<PFGI::btn_resize>(InstData data, ast::ArrayType *ar
   llvm::LLVMContext &ctx = data.mod->getContext();
   llvm::Type *type = generateType(ctx, arr);
   llvm::FunctionType *sig = llvm::FunctionType::get(
-    voidTy(ctx), {type->getPointerTo(), lenTy(ctx)}, false
+    voidTy(ctx), {type->getPointerTo(), getType<Uint>(ctx)}, false
   );
   llvm::Function *func = makeInternalFunc(data.mod, sig, "btn_resize");
   assignUnaryCtorAttrs(func);
   FuncBuilder builder{func};
   
   /*
+  arr_own(array)
   if len <= array.len
     destroy_n(array.dat + len, array.len - len)
   else
@@ -493,8 +550,9 @@ llvm::Function *stela::genFn<PFGI::btn_resize>(InstData data, ast::ArrayType *ar
   llvm::BasicBlock *constructBlock = builder.makeBlock();
   llvm::BasicBlock *reallocBlock = builder.makeBlock();
   llvm::BasicBlock *doneBlock = builder.makeBlock();
-  llvm::Value *array = builder.ir.CreateLoad(func->arg_begin());
-  llvm::Value *len = func->arg_begin() + 1;
+  llvm::Function *own = data.inst.get<PFGI::arr_own>(arr);
+  llvm::Value *array = builder.ir.CreateCall(own, func->arg_begin());
+  llvm::Value *len = builder.ir.CreateZExt(func->arg_begin() + 1, lenTy(ctx));
   llvm::Value *arrayLenPtr = builder.ir.CreateStructGEP(array, array_idx_len);
   llvm::Value *arrayLen = builder.ir.CreateLoad(arrayLenPtr);
   llvm::Value *arrayDatPtr = builder.ir.CreateStructGEP(array, array_idx_dat);
@@ -541,13 +599,14 @@ llvm::Function *stela::genFn<PFGI::btn_reserve>(InstData data, ast::ArrayType *a
   llvm::LLVMContext &ctx = data.mod->getContext();
   llvm::Type *type = generateType(ctx, arr);
   llvm::FunctionType *sig = llvm::FunctionType::get(
-    voidTy(ctx), {type->getPointerTo(), lenTy(ctx)}, false
+    voidTy(ctx), {type->getPointerTo(), getType<Uint>(ctx)}, false
   );
   llvm::Function *func = makeInternalFunc(data.mod, sig, "btn_reserve");
   assignUnaryCtorAttrs(func);
   FuncBuilder builder{func};
   
   /*
+  arr_own(array)
   if cap > array.cap
     reallocate array, cap
     return
@@ -557,8 +616,9 @@ llvm::Function *stela::genFn<PFGI::btn_reserve>(InstData data, ast::ArrayType *a
   
   llvm::BasicBlock *reallocBlock = builder.makeBlock();
   llvm::BasicBlock *doneBlock = builder.makeBlock();
-  llvm::Value *cap = func->arg_begin() + 1;
-  llvm::Value *array = builder.ir.CreateLoad(func->arg_begin());
+  llvm::Value *cap = builder.ir.CreateZExt(func->arg_begin() + 1, lenTy(ctx));
+  llvm::Function *own = data.inst.get<PFGI::arr_own>(arr);
+  llvm::Value *array = builder.ir.CreateCall(own, func->arg_begin());
   llvm::Value *arrayCap = loadStructElem(builder.ir, array, array_idx_cap);
   llvm::Value *grow = builder.ir.CreateICmpUGT(cap, arrayCap);
   builder.ir.CreateCondBr(grow, reallocBlock, doneBlock);
@@ -11,6 +11,7 @@
 #include "llvm.hpp"
 #include "symbols.hpp"
 #include "gen types.hpp"
+#include "retain ptr.hpp"
 #include "categories.hpp"
 #include "gen helpers.hpp"
 #include "generate type.hpp"
@@ -24,6 +25,44 @@ using namespace stela;
 
 namespace {
 
+/// Storage of an array literal with constant elements. The storage is immortal
+/// so that evaluating the literal doesn't allocate. The elements are constant
+llvm::Constant *immortalArray(
+  llvm::Module *module,
+  llvm::Type *type,
+  llvm::Constant *elems,
+  const uint64_t size,
+  const llvm::Twine &name
+) {
+  llvm::LLVMContext &ctx = module->getContext();
+  auto *storageTy = llvm::cast<llvm::StructType>(type->getPointerElementType());
+  auto *dat = new llvm::GlobalVariable{
+    *module,
+    elems->getType(),
+    true,
+    llvm::GlobalVariable::PrivateLinkage,
+    elems,
+    name + "_dat"
+  };
+  dat->setUnnamedAddr(llvm::GlobalValue::UnnamedAddr::Global);
+  llvm::Constant *len = llvm::ConstantInt::get(lenTy(ctx), size);
+  llvm::Constant *storage = llvm::ConstantStruct::get(storageTy, {
+    llvm::ConstantInt::get(refTy(ctx), immortal_count),
+    len,
+    len,
+    llvm::ConstantExpr::getPointerCast(dat, storageTy->getStructElementType(array_idx_dat))
+  });
+  // the reference count is modified so the storage is not constant
+  return new llvm::GlobalVariable{
+    *module,
+    storageTy,
+    false,
+    llvm::GlobalVariable::PrivateLinkage,
+    storage,
+    name
+  };
+}
+
 class Visitor final : public ast::Visitor {
 public:
   Visitor(Scope &temps, gen::Ctx ctx, FuncBuilder &builder, llvm::Value *closure)
@@ -35,6 +74,7 @@ public:
 
   gen::Expr visitValue(ast::Expression *expr) {
     result = nullptr;
+    modify = false;
     expr->accept(*this);
     const ValueCat valueCat = classifyValue(expr);
     const TypeCat typeCat = classifyType(expr->exprType.get());
@@ -44,13 +84,15 @@ public:
       return {value, valueCat};
     }
   }
-  gen::Expr visitExpr(ast::Expression *expr, llvm::Value *resultAddr) {
+  gen::Expr visitExpr(ast::Expression *expr, llvm::Value *resultAddr, const bool mod = false) {
     result = resultAddr;
+    modify = mod;
     expr->accept(*this);
     return {value, classifyValue(expr)};
   }
   gen::Expr visitBool(ast::Expression *expr) {
     result = nullptr;
+    modify = false;
     expr->accept(*this);
     const ValueCat valueCat = classifyValue(expr);
     return {convertToBool(expr->exprType.get(), {value, valueCat}), ValueCat::prvalue};
@@ -248,7 +290,7 @@ public:
   }
   llvm::Value *visitParam(ast::Type *type, ast::ParamRef ref, ast::Expression *expr, Object *destroy) {
     if (ref == ast::ParamRef::ref) {
-      const gen::Expr evalExpr = visitExpr(expr, nullptr);
+      const gen::Expr evalExpr = visitExpr(expr, nullptr, true);
       assert(evalExpr.cat == ValueCat::lvalue);
       return evalExpr.obj;
     }
@@ -337,7 +379,8 @@ public:
   void callFunc(ast::FuncCall &call, ast::Func *func, llvm::Value *resultAddr) {
     std::vector<llvm::Value *> args;
     args.reserve(1 + call.args.size());
-    llvm::FunctionType *funcType = func->llvmFunc->getFunctionType();
+    llvm::Function *callee = importFunc(ctx.mod, func->llvmFunc);
+    llvm::FunctionType *funcType = callee->getFunctionType();
     std::vector<Object> dtors;
     dtors.resize(1 + call.args.size());
     if (func->receiver) {
@@ -348,7 +391,7 @@ public:
       args.push_back(llvm::UndefValue::get(voidPtrTy(ctx.llvm)));
     }
     pushArgs(args, call.args, func->params, dtors);
-    genCall(func->llvmFunc, funcType, args, resultAddr, &call);
+    genCall(callee, funcType, args, resultAddr, &call);
     destroyArgs(dtors);
   }
   void callBtnFunc(ast::FuncCall &call, ast::BtnFunc *btnFunc, llvm::Value *resultAddr) {
@@ -373,7 +416,8 @@ public:
   void callExtFunc(ast::FuncCall &call, ast::ExtFunc *func, llvm::Value *resultAddr) {
     std::vector<llvm::Value *> args;
     args.reserve(1 + call.args.size());
-    llvm::FunctionType *funcType = func->llvmFunc->getFunctionType();
+    llvm::Function *callee = importFunc(ctx.mod, func->llvmFunc);
+    llvm::FunctionType *funcType = callee->getFunctionType();
     std::vector<Object> dtors;
     dtors.resize(1 + call.args.size());
     if (func->receiver.type) {
@@ -387,7 +431,7 @@ public:
         param.type.get(), param.ref, call.args[a].get(), &dtors[a]
       ));
     }
-    genCall(func->llvmFunc, funcType, args, resultAddr, &call);
+    genCall(callee, funcType, args, resultAddr, &call);
     destroyArgs(dtors);
   }
   
@@ -403,7 +447,7 @@ public:
     }
   }
   
-  llvm::Value *materialize(ast::Expression *expr) {
+  llvm::Value *materialize(ast::Expression *expr, const bool mod = false) {
     if (classifyValue(expr) == ValueCat::prvalue) {
       ast::Type *type = expr->exprType.get();
       llvm::Value *object = builder.alloc(generateType(ctx.llvm, type));
@@ -411,13 +455,13 @@ public:
       temps.push_back({object, type});
       return object;
     } else {
-      return visitExpr(expr, nullptr).obj;
+      return visitExpr(expr, nullptr, mod).obj;
     }
   }
   
   void visit(ast::MemberIdent &mem) override {
     llvm::Value *resultAddr = result;
-    llvm::Value *object = materialize(mem.object.get());
+    llvm::Value *object = materialize(mem.object.get(), modify);
     ast::Type *objectType = concreteType(mem.object->exprType.get());
     if (auto *strut = dynamic_cast<ast::StructType *>(objectType)) {
       value = builder.ir.CreateStructGEP(object, mem.index);
@@ -442,14 +486,21 @@ public:
   
   void visit(ast::Subscript &sub) override {
     llvm::Value *resultAddr = result;
-    llvm::Value *object = materialize(sub.object.get());
+    const bool mod = modify;
+    llvm::Value *object = materialize(sub.object.get(), mod);
     gen::Expr index = visitValue(sub.index.get());
     ast::BtnType *indexType = concreteType<ast::BtnType>(sub.index->exprType.get());
     
     auto *arr = concreteType<ast::ArrayType>(sub.object->exprType.get());
     assert(arr);
+    // immortal storage is only copied when an element is modified
+    if (mod) {
+      builder.ir.CreateCall(ctx.inst.get<PFGI::arr_own>(arr), {object});
+    }
     llvm::Function *indexFn;
-    if (indexType->value == ast::BtnTypeEnum::Sint) {
+    if (sub.inBounds || !ctx.boundsChecks) {
+      indexFn = ctx.inst.get<PFGI::arr_idx>(arr);
+    } else if (indexType->value == ast::BtnTypeEnum::Sint) {
       indexFn = ctx.inst.get<PFGI::arr_idx_s>(arr);
     } else {
       indexFn = ctx.inst.get<PFGI::arr_idx_u>(arr);
@@ -462,7 +513,8 @@ public:
   void constructIdent(
     ast::Statement *definition,
     ast::Type *exprType,
-    llvm::Value *resultAddr
+    llvm::Value *resultAddr,
+    const ValueCat cat
   ) {
     value = nullptr;
     if (auto *param = dynamic_cast<ast::FuncParam *>(definition)) {
@@ -470,13 +522,13 @@ public:
     } else if (auto *decl = dynamic_cast<ast::DeclAssign *>(definition)) {
       value = decl->llvmAddr;
     } else if (auto *var = dynamic_cast<ast::Var *>(definition)) {
-      value = var->llvmAddr;
+      value = importGlobal(ctx.mod, var->llvmAddr);
     } else if (auto *let = dynamic_cast<ast::Let *>(definition)) {
-      value = let->llvmAddr;
+      value = importGlobal(ctx.mod, let->llvmAddr);
     }
     if (value) {
       if (resultAddr) {
-        lifetime.construct(exprType, resultAddr, {value, ValueCat::lvalue});
+        lifetime.construct(exprType, resultAddr, {value, cat});
         value = nullptr;
       }
       return;
@@ -484,12 +536,13 @@ public:
     if (auto *func = dynamic_cast<ast::Func *>(definition)) {
       auto *funcType = assertDownCast<ast::FuncType>(exprType);
       llvm::Function *funCtor = ctx.inst.get<PFGI::clo_fun_ctor>(funcType);
+      llvm::Function *callee = importFunc(ctx.mod, func->llvmFunc);
       if (resultAddr) {
-        builder.ir.CreateCall(funCtor, {resultAddr, func->llvmFunc});
+        builder.ir.CreateCall(funCtor, {resultAddr, callee});
         value = nullptr;
       } else {
         llvm::Value *fnAddr = builder.alloc(generateType(ctx.llvm, funcType));
-        builder.ir.CreateCall(funCtor, {fnAddr, func->llvmFunc});
+        builder.ir.CreateCall(funCtor, {fnAddr, callee});
         value = fnAddr;
       }
       // @TODO lifetime.startLife
@@ -501,7 +554,8 @@ public:
       constructIdent(
         ident.definition,
         ident.exprType.get(),
-        resultAddr
+        resultAddr,
+        classifyValue(&ident)
       );
     } else {
       assert(closure);
@@ -515,6 +569,7 @@ public:
     auto *folsBlock = builder.makeBlock();
     auto *doneBlock = builder.makeBlock();
     llvm::Value *resultAddr = result;
+    const bool mod = modify;
     
     builder.setCurr(condBlock);
     builder.ir.CreateCondBr(visitBool(tern.cond.get()).obj, trooBlock, folsBlock);
@@ -532,9 +587,9 @@ public:
       value = nullptr;
     } else if (trooCat == ValueCat::lvalue && folsCat == ValueCat::lvalue) {
       builder.setCurr(trooBlock);
-      troo = visitExpr(tern.troo.get(), nullptr);
+      troo = visitExpr(tern.troo.get(), nullptr, mod);
       builder.setCurr(folsBlock);
-      fols = visitExpr(tern.fols.get(), nullptr);
+      fols = visitExpr(tern.fols.get(), nullptr, mod);
     } else if (classifyType(tern.exprType.get()) == TypeCat::trivially_copyable) {
       builder.setCurr(trooBlock);
       troo = visitValue(tern.troo.get());
@@ -611,13 +666,10 @@ public:
     if (str.value.empty()) {
       lifetime.defConstruct(type, addr);
     } else {
-      llvm::Function *ctor = ctx.inst.get<PFGI::arr_len_ctor>(type);
-      llvm::Constant *size = llvm::ConstantInt::get(
-        lenTy(addr->getContext()), str.value.size()
-      );
-      llvm::Value *basePtr = builder.ir.CreateCall(ctor, {addr, size});
-      llvm::Value *strPtr = builder.ir.CreateGlobalStringPtr(str.value);
-      builder.ir.CreateMemCpy(basePtr, 1, strPtr, 1, str.value.size());
+      llvm::Type *arrayTy = generateType(ctx.llvm, type);
+      llvm::Constant *chars = llvm::ConstantDataArray::getString(ctx.llvm, str.value, false);
+      llvm::Constant *storage = immortalArray(ctx.mod, arrayTy, chars, str.value.size(), "str");
+      builder.ir.CreateStore(storage, addr);
     }
     value = addr;
   }
@@ -677,6 +729,10 @@ public:
     llvm::Value *addr = result ? result : builder.alloc(generateType(ctx.llvm, type));
     if (arr.exprs.empty()) {
       lifetime.defConstruct(type, addr);
+    } else if (llvm::Constant *elems = constantElems(arr)) {
+      llvm::Type *arrayTy = generateType(ctx.llvm, type);
+      llvm::Constant *storage = immortalArray(ctx.mod, arrayTy, elems, arr.exprs.size(), "arr");
+      builder.ir.CreateStore(storage, addr);
     } else {
       llvm::Function *ctor = ctx.inst.get<PFGI::arr_len_ctor>(type);
       llvm::Constant *size = llvm::ConstantInt::get(
@@ -734,7 +790,8 @@ public:
         constructIdent(
           cap.object,
           cap.type.get(),
-          capAddr
+          capAddr,
+          ValueCat::lvalue
         );
       } else {
         assert(closure);
@@ -763,6 +820,54 @@ private:
   llvm::Value *closure = nullptr;
   llvm::Value *value = nullptr;
   llvm::Value *result = nullptr;
+  /// The expression is about to be modified so immortal arrays are copied
+  bool modify = false;
+  
+  /// The value of a literal or a negated literal. Returns nullptr if the
+  /// expression is not a constant
+  llvm::Constant *constantValue(ast::Expression *expr) {
+    if (auto *unary = dynamic_cast<ast::UnaryExpr *>(expr)) {
+      if (unary->oper != ast::UnOp::neg) {
+        return nullptr;
+      }
+      llvm::Constant *operand = constantValue(unary->expr.get());
+      if (!operand) {
+        return nullptr;
+      } else if (operand->getType()->isFloatingPointTy()) {
+        return llvm::ConstantExpr::getFNeg(operand);
+      } else {
+        return llvm::ConstantExpr::getNeg(operand);
+      }
+    }
+    if (!dynamic_cast<ast::NumberLiteral *>(expr) &&
+        !dynamic_cast<ast::CharLiteral *>(expr) &&
+        !dynamic_cast<ast::BoolLiteral *>(expr)) {
+      return nullptr;
+    }
+    // literals don't emit any instructions
+    result = nullptr;
+    expr->accept(*this);
+    return llvm::cast<llvm::Constant>(value);
+  }
+  /// The elements of an array literal of trivially copyable constants.
+  /// Returns nullptr if any element is not a constant
+  llvm::Constant *constantElems(ast::ArrayLiteral &arr) {
+    ast::ArrayType *type = assertDownCast<ast::ArrayType>(arr.exprType.get());
+    if (classifyType(type->elem.get()) != TypeCat::trivially_copyable) {
+      return nullptr;
+    }
+    llvm::Type *elemTy = generateType(ctx.llvm, type->elem.get());
+    std::vector<llvm::Constant *> elems;
+    elems.reserve(arr.exprs.size());
+    for (const ast::ExprPtr &expr : arr.exprs) {
+      llvm::Constant *elem = constantValue(expr.get());
+      if (!elem || elem->getType() != elemTy) {
+        return nullptr;
+      }
+      elems.push_back(elem);
+    }
+    return llvm::ConstantArray::get(llvm::ArrayType::get(elemTy, elems.size()), elems);
+  }
   
   void storeValueAsResult(llvm::Value *resultAddr) {
     if (resultAddr) {
@@ -813,3 +918,13 @@ gen::Expr stela::generateExpr(
   Visitor visitor{temps, ctx, func.builder, func.closure};
   return visitor.visitExpr(expr, result);
 }
+
+gen::Expr stela::generateModifyExpr(
+  Scope &temps,
+  gen::Ctx ctx,
+  gen::Func func,
+  ast::Expression *expr
+) {
+  Visitor visitor{temps, ctx, func.builder, func.closure};
+  return visitor.visitExpr(expr, nullptr, true);
+}
@@ -37,6 +37,8 @@ struct Func {
 gen::Expr generateValueExpr(Scope &, gen::Ctx, gen::Func, ast::Expression *);
 gen::Expr generateBoolExpr(Scope &, gen::Ctx, gen::Func, ast::Expression *);
 gen::Expr generateExpr(Scope &, gen::Ctx, gen::Func, ast::Expression *, llvm::Value *);
+/// Generate an lvalue that is about to be modified
+gen::Expr generateModifyExpr(Scope &, gen::Ctx, gen::Func, ast::Expression *);
 
 }
 
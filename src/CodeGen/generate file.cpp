@@ -0,0 +1,171 @@
+//
+//  generate file.cpp
+//  STELA
+//
+//  Created by Indi Kernick on 18/10/26.
+//  Copyright © 2026 Indi Kernick. All rights reserved.
+//
+
+#include "generate file.hpp"
+
+#include "profile.hpp"
+#include <llvm/IR/Module.h>
+#include "Log/log output.hpp"
+#include <llvm/Support/Host.h>
+#include "target machine.hpp"
+#include "optimize module.hpp"
+#include <llvm/Support/Program.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/Target/TargetMachine.h>
+#include <llvm/Object/ArchiveWriter.h>
+#include <llvm/Support/TargetRegistry.h>
+
+using namespace stela;
+
+namespace {
+
+/// Objects are position independent so that they can be linked into shared
+/// libraries. The generic CPU is used unless another is given because the
+/// file may be run on a different machine
+std::unique_ptr<llvm::TargetMachine> makeMachine(const OptFlags opt, Log &log) {
+  const std::string triple = llvm::sys::getDefaultTargetTriple();
+  std::string error;
+  const llvm::Target *target = llvm::TargetRegistry::lookupTarget(triple, error);
+  if (target == nullptr) {
+    log.error() << error << fatal;
+  }
+  std::unique_ptr<llvm::TargetMachine> machine{target->createTargetMachine(
+    triple,
+    opt.cpu ? opt.cpu : "generic",
+    opt.features ? llvm::join(targetFeatures(opt), ",") : "",
+    {},
+    llvm::Reloc::PIC_,
+    llvm::None,
+    codeGenOpt(opt)
+  )};
+  if (machine == nullptr) {
+    log.error() << "Failed to create target machine" << fatal;
+  }
+  return machine;
+}
+
+void writeFile(const std::string &path, llvm::StringRef data, Log &log) {
+  std::error_code code;
+  llvm::raw_fd_ostream file{path, code};
+  if (code) {
+    log.error() << "Failed to open \"" << path << "\": " << code.message() << fatal;
+  }
+  file << data;
+}
+
+void writeArchive(
+  const std::string &path,
+  llvm::StringRef object,
+  const llvm::Triple &triple,
+  Log &log
+) {
+  std::vector<llvm::NewArchiveMember> members;
+  members.emplace_back(llvm::MemoryBufferRef{object, "stela.o"});
+  llvm::Error err = llvm::writeArchive(
+    path,
+    members,
+    true,
+    triple.isOSDarwin() ? llvm::object::Archive::K_DARWIN : llvm::object::Archive::K_GNU,
+    true,
+    false
+  );
+  if (err) {
+    log.error() << llvm::toString(std::move(err)) << fatal;
+  }
+}
+
+/// LLVM cannot link shared libraries by itself so the system compiler driver
+/// is used
+void linkShared(
+  const std::string &path,
+  llvm::StringRef object,
+  const llvm::Triple &triple,
+  Log &log
+) {
+  auto driver = llvm::sys::findProgramByName("cc");
+  if (!driver) {
+    log.error() << "Cannot find a linker to create \"" << path << "\"" << fatal;
+  }
+  llvm::SmallString<128> objectPath;
+  if (llvm::sys::fs::createTemporaryFile("stela", "o", objectPath)) {
+    log.error() << "Failed to create a temporary file" << fatal;
+  }
+  writeFile(objectPath.str().str(), object, log);
+  
+  std::vector<llvm::StringRef> args = {*driver, "-shared", "-o", path, objectPath};
+  if (triple.isOSDarwin()) {
+    // external functions are provided by the host
+    args.push_back("-undefined");
+    args.push_back("dynamic_lookup");
+  }
+  std::string error;
+  const int status = llvm::sys::ExecuteAndWait(*driver, args, llvm::None, {}, 0, 0, &error);
+  llvm::sys::fs::remove(objectPath);
+  if (status != 0) {
+    log.error() << "Failed to link \"" << path << "\" " << error << fatal;
+  }
+}
+
+}
+
+bool stela::emitObject(
+  llvm::TargetMachine *machine,
+  llvm::Module &module,
+  llvm::SmallVectorImpl<char> &object
+) {
+  llvm::raw_svector_ostream stream{object};
+  llvm::legacy::PassManager passes;
+  if (machine->addPassesToEmitFile(
+    passes, stream, nullptr, llvm::TargetMachine::CGFT_ObjectFile
+  )) {
+    return false;
+  }
+  passes.run(module);
+  return true;
+}
+
+void stela::generateFile(
+  std::unique_ptr<llvm::Module> module,
+  const std::string &path,
+  const FileKind kind,
+  LogSink &sink,
+  const OptFlags opt,
+  PassTimings *timings
+) {
+  Log log{sink, LogCat::generate};
+  log.status() << "Writing \"" << path << "\"" << endlog;
+  
+  if (hasHostAddresses(*module)) {
+    log.error() << "Code generated with OptFlags::allocator cannot be written to a file" << fatal;
+  }
+  checkProfile(opt, log);
+  std::unique_ptr<llvm::TargetMachine> machine = makeMachine(opt, log);
+  if (opt.optimizeIR) {
+    optimizeModule(machine.get(), module.get(), opt, timings);
+  } else {
+    setTarget(*module, *machine);
+  }
+  
+  llvm::SmallVector<char, 0> object;
+  if (!emitObject(machine.get(), *module, object)) {
+    log.error() << "Target cannot emit object files" << fatal;
+  }
+  const llvm::StringRef data{object.data(), object.size()};
+  
+  switch (kind) {
+    case FileKind::object:
+      return writeFile(path, data, log);
+    case FileKind::archive:
+      return writeArchive(path, data, machine->getTargetTriple(), log);
+    case FileKind::shared:
+      return linkShared(path, data, machine->getTargetTriple(), log);
+  }
+}
@@ -0,0 +1,29 @@
+//
+//  generate file.hpp
+//  STELA
+//
+//  Created by Indi Kernick on 18/10/26.
+//  Copyright © 2026 Indi Kernick. All rights reserved.
+//
+
+#ifndef stela_generate_file_hpp
+#define stela_generate_file_hpp
+
+#include <llvm/ADT/SmallVector.h>
+
+namespace llvm {
+
+class Module;
+class TargetMachine;
+
+}
+
+namespace stela {
+
+/// Compile a module into an object file in memory. Returns false if the
+/// target cannot emit object files
+bool emitObject(llvm::TargetMachine *, llvm::Module &, llvm::SmallVectorImpl<char> &);
+
+}
+
+#endif
@@ -6,6 +6,7 @@
 //  Copyright © 2018 Indi Kernick. All rights reserved.
 //
 
+#include "allocator.hpp"
 #include "inst data.hpp"
 #include "gen types.hpp"
 #include "gen helpers.hpp"
@@ -13,9 +14,68 @@
 #include "lifetime exprs.hpp"
 #include "function builder.hpp"
 #include "func instantiations.hpp"
+#include <llvm/Support/DynamicLibrary.h>
 
 using namespace stela;
 
+namespace {
+
+/// A pointer into the host process that is a constant in the code
+template <typename Ptr>
+llvm::Constant *hostPtr(llvm::Type *type, Ptr *ptr) {
+  llvm::Type *intTy = getType<size_t>(type->getContext());
+  llvm::Constant *addr = constantFor(intTy, reinterpret_cast<size_t>(ptr));
+  return llvm::ConstantExpr::getIntToPtr(addr, type);
+}
+
+/// Call one of the callbacks of the allocator with the user pointer
+template <typename Callback>
+llvm::Value *callAllocator(
+  llvm::IRBuilder<> &ir,
+  const Allocator &allocator,
+  Callback *callback,
+  llvm::Type *ret,
+  std::vector<llvm::Value *> args
+) {
+  llvm::Type *memTy = voidPtrTy(ir.getContext());
+  args.insert(args.begin(), hostPtr(memTy, allocator.user));
+  std::vector<llvm::Type *> params;
+  for (llvm::Value *arg : args) {
+    params.push_back(arg->getType());
+  }
+  llvm::FunctionType *type = llvm::FunctionType::get(ret, params, false);
+  return ir.CreateCall(hostPtr(type->getPointerTo(), callback), args);
+}
+
+/// Declare one of the functions of the pool so that it can be called from
+/// the JIT
+template <typename Func>
+llvm::Function *declarePoolFunc(
+  llvm::Module *module,
+  llvm::FunctionType *type,
+  const char *name,
+  Func *impl
+) {
+  llvm::sys::DynamicLibrary::AddSymbol(name, reinterpret_cast<void *>(impl));
+  return declareCFunc(module, type, name);
+}
+
+/// Return the pointer returned by an allocation function or panic if it's
+/// null
+void retOrPanic(InstData data, FuncBuilder &builder, llvm::Value *ptr) {
+  llvm::BasicBlock *okBlock = builder.makeBlock();
+  llvm::BasicBlock *errorBlock = builder.makeBlock();
+  llvm::Value *isNotNull = builder.ir.CreateIsNotNull(ptr);
+  likely(builder.ir.CreateCondBr(isNotNull, okBlock, errorBlock));
+  
+  builder.setCurr(okBlock);
+  builder.ir.CreateRet(ptr);
+  builder.setCurr(errorBlock);
+  callPanic(builder.ir, data.inst.get<FGI::panic>(), "Out of memory");
+}
+
+}
+
 template <>
 llvm::Function *stela::genFn<FGI::panic>(InstData data) {
   llvm::LLVMContext &ctx = data.mod->getContext();
@@ -50,26 +110,26 @@ llvm::Function *stela::genFn<FGI::alloc>(InstData data) {
   
   llvm::Type *memTy = voidPtrTy(ctx);
   llvm::Type *sizeTy = getType<size_t>(ctx);
-  llvm::FunctionType *mallocType = llvm::FunctionType::get(memTy, {sizeTy}, false);
-  llvm::FunctionType *allocType = mallocType;
+  llvm::FunctionType *allocType = llvm::FunctionType::get(memTy, {sizeTy}, false);
   
-  llvm::Function *malloc = declareCFunc(data.mod, mallocType, "malloc");
   llvm::Function *alloc = makeInternalFunc(data.mod, allocType, "alloc");
-  malloc->addAttribute(0, llvm::Attribute::NoAlias);
   alloc->addAttribute(0, llvm::Attribute::NoAlias);
   alloc->addAttribute(0, llvm::Attribute::NonNull);
   FuncBuilder builder{alloc};
   
-  llvm::BasicBlock *okBlock = builder.makeBlock();
-  llvm::BasicBlock *errorBlock = builder.makeBlock();
-  llvm::Value *ptr = builder.ir.CreateCall(malloc, alloc->arg_begin());
-  llvm::Value *isNotNull = builder.ir.CreateIsNotNull(ptr);
-  likely(builder.ir.CreateCondBr(isNotNull, okBlock, errorBlock));
-  
-  builder.setCurr(okBlock);
-  builder.ir.CreateRet(ptr);
-  builder.setCurr(errorBlock);
-  callPanic(builder.ir, data.inst.get<FGI::panic>(), "Out of memory");
+  llvm::Value *ptr;
+  if (const Allocator *allocator = data.inst.allocator()) {
+    ptr = callAllocator(
+      builder.ir, *allocator, allocator->allocate, memTy, {alloc->arg_begin()}
+    );
+  } else {
+    llvm::Function *pool = declarePoolFunc(
+      data.mod, allocType, "stela_pool_alloc", stela_pool_alloc
+    );
+    pool->addAttribute(0, llvm::Attribute::NoAlias);
+    ptr = builder.ir.CreateCall(pool, alloc->arg_begin());
+  }
+  retOrPanic(data, builder, ptr);
   
   return alloc;
 }
@@ -79,9 +139,55 @@ llvm::Function *stela::genFn<FGI::free>(InstData data) {
   llvm::LLVMContext &ctx = data.mod->getContext();
   llvm::Type *memTy = voidPtrTy(ctx);
   llvm::FunctionType *freeType = llvm::FunctionType::get(voidTy(ctx), {memTy}, false);
-  llvm::Function *free = declareCFunc(data.mod, freeType, "free");
-  free->addParamAttr(0, llvm::Attribute::NoCapture);
-  return free;
+  const Allocator *allocator = data.inst.allocator();
+  if (!allocator) {
+    llvm::Function *free = declarePoolFunc(
+      data.mod, freeType, "stela_pool_free", stela_pool_free
+    );
+    free->addParamAttr(0, llvm::Attribute::NoCapture);
+    return free;
+  }
+  
+  llvm::Function *dealloc = makeInternalFunc(data.mod, freeType, "dealloc");
+  dealloc->addParamAttr(0, llvm::Attribute::NoCapture);
+  FuncBuilder builder{dealloc};
+  callAllocator(
+    builder.ir, *allocator, allocator->deallocate, voidTy(ctx), {dealloc->arg_begin()}
+  );
+  builder.ir.CreateRetVoid();
+  return dealloc;
+}
+
+template <>
+llvm::Function *stela::genFn<FGI::realloc>(InstData data) {
+  llvm::LLVMContext &ctx = data.mod->getContext();
+  
+  llvm::Type *memTy = voidPtrTy(ctx);
+  llvm::Type *sizeTy = getType<size_t>(ctx);
+  llvm::FunctionType *reallocType = llvm::FunctionType::get(memTy, {memTy, sizeTy}, false);
+  llvm::Function *realloc = makeInternalFunc(data.mod, reallocType, "realloc_mem");
+  realloc->addAttribute(0, llvm::Attribute::NoAlias);
+  realloc->addAttribute(0, llvm::Attribute::NonNull);
+  FuncBuilder builder{realloc};
+  
+  llvm::Value *ptr;
+  if (const Allocator *allocator = data.inst.allocator()) {
+    ptr = callAllocator(
+      builder.ir,
+      *allocator,
+      allocator->reallocate,
+      memTy,
+      {realloc->arg_begin(), realloc->arg_begin() + 1}
+    );
+  } else {
+    llvm::Function *pool = declarePoolFunc(
+      data.mod, reallocType, "stela_pool_realloc", stela_pool_realloc
+    );
+    ptr = builder.ir.CreateCall(pool, {realloc->arg_begin(), realloc->arg_begin() + 1});
+  }
+  retOrPanic(data, builder, ptr);
+  
+  return realloc;
 }
 
 template <>
@@ -7,6 +7,7 @@
 //
 
 #include "gen types.hpp"
+#include "retain ptr.hpp"
 #include "gen helpers.hpp"
 #include "function builder.hpp"
 #include "func instantiations.hpp"
@@ -29,6 +30,26 @@ llvm::Value *refChange(llvm::IRBuilder<> &ir, llvm::Value *ptr, const RefChg chg
   return changed;
 }
 
+/// Immortal storage may be shared by engines and threads so its reference
+/// count is never changed
+llvm::Value *isMortal(llvm::IRBuilder<> &ir, llvm::Value *ref) {
+  return ir.CreateICmpULT(ref, constantFor(ref, immortal_count / 2));
+}
+
+/// Returns the reference count before it was changed
+llvm::Value *atomicRefChange(llvm::IRBuilder<> &ir, llvm::Value *ptr, const RefChg chg) {
+  llvm::Value *one = constantForPtr(ptr, 1);
+  if (chg == RefChg::inc) {
+    return ir.CreateAtomicRMW(
+      llvm::AtomicRMWInst::Add, ptr, one, llvm::AtomicOrdering::Monotonic
+    );
+  } else {
+    return ir.CreateAtomicRMW(
+      llvm::AtomicRMWInst::Sub, ptr, one, llvm::AtomicOrdering::AcquireRelease
+    );
+  }
+}
+
 }
 
 template <>
@@ -41,17 +62,31 @@ llvm::Function *stela::genFn<FGI::ptr_inc>(InstData data) {
   FuncBuilder builder{func};
   
   /*
-  if ptr != null
+  if ptr != null && ptr.ref < immortal / 2
     ptr.ref++
   */
   
+  llvm::BasicBlock *checkBlock = builder.makeBlock();
   llvm::BasicBlock *incBlock = builder.makeBlock();
   llvm::BasicBlock *doneBlock = builder.makeBlock();
   llvm::Value *ptrNotNull = builder.ir.CreateIsNotNull(func->arg_begin());
-  builder.ir.CreateCondBr(ptrNotNull, incBlock, doneBlock);
+  builder.ir.CreateCondBr(ptrNotNull, checkBlock, doneBlock);
+  
+  builder.setCurr(checkBlock);
+  llvm::Value *ref;
+  if (data.inst.atomicRefCounts()) {
+    ref = loadAtomicRef(builder.ir, func->arg_begin(), llvm::AtomicOrdering::Monotonic);
+  } else {
+    ref = builder.ir.CreateLoad(func->arg_begin());
+  }
+  likely(builder.ir.CreateCondBr(isMortal(builder.ir, ref), incBlock, doneBlock));
   
   builder.setCurr(incBlock);
-  refChange(builder.ir, func->arg_begin(), RefChg::inc);
+  if (data.inst.atomicRefCounts()) {
+    atomicRefChange(builder.ir, func->arg_begin(), RefChg::inc);
+  } else {
+    refChange(builder.ir, func->arg_begin(), RefChg::inc);
+  }
   builder.ir.CreateBr(doneBlock);
   
   builder.setCurr(doneBlock);
@@ -73,14 +108,21 @@ llvm::Function *stela::genFn<FGI::ptr_dec>(InstData data) {
   FuncBuilder builder{func};
   
   /*
-  if ptr != null
+  if ptr != null && ptr.ref < immortal / 2
     ptr.ref--
     if ptr.ref == 0
       dtor
       free ptr
+  
+  with atomic reference counts:
+  if ptr != null
+    if ptr.ref == 1 || (ptr.ref < immortal / 2 && atomic_sub(ptr.ref, 1) == 1)
+      dtor
+      free ptr
   */
   
   llvm::BasicBlock *decBlock = builder.makeBlock();
+  llvm::BasicBlock *changeBlock = builder.makeBlock();
   llvm::BasicBlock *destroyBlock = builder.makeBlock();
   llvm::BasicBlock *doneBlock = builder.makeBlock();
   llvm::Value *dtor = func->arg_begin();
@@ -89,9 +131,30 @@ llvm::Function *stela::genFn<FGI::ptr_dec>(InstData data) {
   builder.ir.CreateCondBr(ptrNotNull, decBlock, doneBlock);
   
   builder.setCurr(decBlock);
-  llvm::Value *subed = refChange(builder.ir, ptr, RefChg::dec);
-  llvm::Value *refIsZero = builder.ir.CreateICmpEQ(subed, constantFor(subed, 0));
-  builder.ir.CreateCondBr(refIsZero, destroyBlock, doneBlock);
+  llvm::Value *released;
+  if (data.inst.atomicRefCounts()) {
+    // the only reference cannot be copied by another thread so releasing it
+    // doesn't need an atomic operation
+    llvm::BasicBlock *sharedBlock = builder.makeBlock();
+    llvm::Value *ref = loadAtomicRef(builder.ir, ptr, llvm::AtomicOrdering::Acquire);
+    llvm::Value *unique = builder.ir.CreateICmpEQ(ref, constantFor(ref, 1));
+    builder.ir.CreateCondBr(unique, destroyBlock, sharedBlock);
+    
+    builder.setCurr(sharedBlock);
+    likely(builder.ir.CreateCondBr(isMortal(builder.ir, ref), changeBlock, doneBlock));
+    
+    builder.setCurr(changeBlock);
+    llvm::Value *prev = atomicRefChange(builder.ir, ptr, RefChg::dec);
+    released = builder.ir.CreateICmpEQ(prev, constantFor(prev, 1));
+  } else {
+    llvm::Value *ref = builder.ir.CreateLoad(ptr);
+    likely(builder.ir.CreateCondBr(isMortal(builder.ir, ref), changeBlock, doneBlock));
+    
+    builder.setCurr(changeBlock);
+    llvm::Value *subed = refChange(builder.ir, ptr, RefChg::dec);
+    released = builder.ir.CreateICmpEQ(subed, constantFor(subed, 0));
+  }
+  builder.ir.CreateCondBr(released, destroyBlock, doneBlock);
   
   builder.setCurr(destroyBlock);
   llvm::Value *voidPtr = builder.ir.CreatePointerCast(ptr, voidPtrTy(ctx));
@@ -9,14 +9,19 @@
 #include "generate stat.hpp"
 
 #include "llvm.hpp"
+#include <algorithm>
 #include "symbols.hpp"
+#include "last use.hpp"
 #include "categories.hpp"
+#include "gen helpers.hpp"
 #include "compare exprs.hpp"
+#include "bounds checks.hpp"
 #include "generate type.hpp"
 #include "generate expr.hpp"
 #include "lifetime exprs.hpp"
 #include "function builder.hpp"
 #include "lower expressions.hpp"
+#include <llvm/ADT/SmallPtrSet.h>
 #include "Utils/iterator range.hpp"
 #include "Semantic/scope traverse.hpp"
 
@@ -51,6 +56,9 @@ public:
   gen::Expr genExpr(ast::Expression *expr) {
     return generateExpr(scopes.back(), ctx, makeFunc(), expr, nullptr);
   }
+  gen::Expr genModify(ast::Expression *expr) {
+    return generateModifyExpr(scopes.back(), ctx, makeFunc(), expr);
+  }
   void genCondBr(
     ast::Expression *cond,
     llvm::BasicBlock *troo,
@@ -173,6 +181,129 @@ public:
       builder.terminate(done);
     }
   }
+  
+  /// The value of a case that is an integer or character literal
+  llvm::ConstantInt *caseConstant(llvm::IntegerType *type, ast::Expression *expr) {
+    bool negate = false;
+    if (auto *unary = dynamic_cast<ast::UnaryExpr *>(expr)) {
+      if (unary->oper != ast::UnOp::neg) {
+        return nullptr;
+      }
+      negate = true;
+      expr = unary->expr.get();
+    }
+    uint64_t value;
+    if (auto *chr = dynamic_cast<ast::CharLiteral *>(expr)) {
+      value = static_cast<uint64_t>(chr->value);
+    } else if (auto *num = dynamic_cast<ast::NumberLiteral *>(expr)) {
+      if (auto *byte = std::get_if<Byte>(&num->value)) {
+        value = static_cast<uint64_t>(*byte);
+      } else if (auto *chr = std::get_if<Char>(&num->value)) {
+        value = static_cast<uint64_t>(*chr);
+      } else if (auto *sint = std::get_if<Sint>(&num->value)) {
+        value = static_cast<uint64_t>(*sint);
+      } else if (auto *uint = std::get_if<Uint>(&num->value)) {
+        value = static_cast<uint64_t>(*uint);
+      } else {
+        return nullptr;
+      }
+    } else {
+      return nullptr;
+    }
+    return llvm::ConstantInt::get(type, negate ? -value : value);
+  }
+  
+  /// Lower a switch on an integer or char with literal cases to a switch
+  /// instruction so that the backend can choose a jump table or binary search
+  bool emitIntSwitch(
+    ast::Switch &swich,
+    const Blocks &caseBlocks,
+    llvm::BasicBlock *otherwise,
+    llvm::Value *value
+  ) {
+    auto *btn = concreteType<ast::BtnType>(swich.expr->exprType.get());
+    if (!btn || classifyArith(btn) == ArithCat::floating_point) {
+      return false;
+    }
+    auto *type = llvm::cast<llvm::IntegerType>(value->getType()->getPointerElementType());
+    std::vector<llvm::ConstantInt *> constants(swich.cases.size());
+    for (size_t c = 0; c != swich.cases.size(); ++c) {
+      if (ast::Expression *expr = swich.cases[c].expr.get()) {
+        constants[c] = caseConstant(type, expr);
+        if (!constants[c]) {
+          return false;
+        }
+      }
+    }
+    
+    llvm::SwitchInst *inst = builder.ir.CreateSwitch(
+      builder.ir.CreateLoad(value), otherwise, static_cast<unsigned>(swich.cases.size())
+    );
+    // the first of a duplicate case is the one that is reached
+    llvm::SmallPtrSet<llvm::ConstantInt *, 16> seen;
+    for (size_t c = 0; c != swich.cases.size(); ++c) {
+      if (constants[c] && seen.insert(constants[c]).second) {
+        inst->addCase(constants[c], caseBlocks[c]);
+      }
+    }
+    return true;
+  }
+  
+  /// Lower a switch on a string with literal cases to a switch on the hash of
+  /// the string. Cases with the same hash are compared in order
+  bool emitStrSwitch(
+    ast::Switch &swich,
+    const Blocks &caseBlocks,
+    llvm::BasicBlock *otherwise,
+    llvm::Value *value
+  ) {
+    auto *arr = concreteType<ast::ArrayType>(swich.expr->exprType.get());
+    if (!arr) {
+      return false;
+    }
+    auto *elem = concreteType<ast::BtnType>(arr->elem.get());
+    if (!elem || elem->value != ast::BtnTypeEnum::Char) {
+      return false;
+    }
+    std::vector<std::pair<uint32_t, size_t>> hashes;
+    for (size_t c = 0; c != swich.cases.size(); ++c) {
+      if (ast::Expression *expr = swich.cases[c].expr.get()) {
+        auto *str = dynamic_cast<ast::StringLiteral *>(expr);
+        if (!str) {
+          return false;
+        }
+        hashes.push_back({hashString(str->value), c});
+      }
+    }
+    std::stable_sort(hashes.begin(), hashes.end(), [](auto a, auto b) {
+      return a.first < b.first;
+    });
+    
+    llvm::Value *hash = builder.ir.CreateCall(ctx.inst.get<PFGI::arr_hash>(arr), {value});
+    llvm::SwitchInst *inst = builder.ir.CreateSwitch(
+      hash, otherwise, static_cast<unsigned>(hashes.size())
+    );
+    llvm::Type *type = value->getType()->getPointerElementType();
+    llvm::IntegerType *hashTy = llvm::cast<llvm::IntegerType>(hash->getType());
+    for (size_t h = 0; h != hashes.size(); ++h) {
+      const auto [hashValue, c] = hashes[h];
+      if (h == 0 || hashes[h - 1].first != hashValue) {
+        llvm::BasicBlock *check = builder.makeBlock();
+        inst->addCase(llvm::ConstantInt::get(hashTy, hashValue), check);
+        builder.setCurr(check);
+      }
+      llvm::Value *cond = equalTo(value, swich.cases[c].expr.get(), type);
+      if (h + 1 == hashes.size() || hashes[h + 1].first != hashValue) {
+        builder.ir.CreateCondBr(cond, caseBlocks[c], otherwise);
+      } else {
+        llvm::BasicBlock *next = builder.makeBlock();
+        builder.ir.CreateCondBr(cond, caseBlocks[c], next);
+        builder.setCurr(next);
+      }
+    }
+    return true;
+  }
+  
   void visit(ast::Switch &swich) override {
     const size_t exprScope = enterScope();
     llvm::Type *type = generateType(ctx.llvm, swich.expr->exprType.get());
@@ -185,16 +316,21 @@ public:
     }
     
     const size_t caseScope = scopes.size();
-    auto checkBlocks = builder.makeBlocks(swich.cases.size());
     auto caseBlocks = builder.makeBlocks(swich.cases.size());
     llvm::BasicBlock *done = builder.makeBlock();
-    builder.ir.CreateBr(checkBlocks[0]);
-    
     const size_t defaultIndex = findDefault(swich);
-    emitCaseChecks(swich, checkBlocks, caseBlocks, done, value, defaultIndex);
+    llvm::BasicBlock *otherwise = defaultIndex == nodefault ? done : caseBlocks[defaultIndex];
     
-    if (defaultIndex != nodefault) {
-      builder.link(checkBlocks.back(), caseBlocks[defaultIndex]);
+    if (
+      !emitIntSwitch(swich, caseBlocks, otherwise, value) &&
+      !emitStrSwitch(swich, caseBlocks, otherwise, value)
+    ) {
+      auto checkBlocks = builder.makeBlocks(swich.cases.size());
+      builder.ir.CreateBr(checkBlocks[0]);
+      emitCaseChecks(swich, checkBlocks, caseBlocks, done, value, defaultIndex);
+      if (defaultIndex != nodefault) {
+        builder.link(checkBlocks.back(), caseBlocks[defaultIndex]);
+      }
     }
     
     emitCaseBodies(swich, caseBlocks, done, caseScope);
@@ -207,6 +343,7 @@ public:
     }
     leaveScope();
   }
+  
   void visit(ast::Terminate &) override {
     destroy(scopes.size() - 1);
   }
@@ -367,7 +504,7 @@ public:
   void visit(ast::Assign &assign) override {
     const size_t exprScope = enterScope();
     ast::Type *type = assign.dst->exprType.get();
-    gen::Expr dst = genExpr(assign.dst.get());
+    gen::Expr dst = genModify(assign.dst.get());
     gen::Expr src = genExpr(assign.src.get());
     assert(glvalue(dst.cat));
     lifetime.assign(type, dst.obj, src);
@@ -429,6 +566,10 @@ void stela::generateStat(
   ast::Block &block
 ) {
   lowerExpressions(block);
+  if (ctx.boundsChecks) {
+    markInBounds(ctx.llvm, block);
+  }
+  markLastUses(rec, params, block);
   Visitor visitor{ctx, func};
   visitor.enterScope();
   // @TODO maybe do parameter insersion in a separate function
@@ -50,6 +50,7 @@ enum class FGI : size_t {
   panic,
   alloc,
   free,
+  realloc,
   ceil_to_pow_2,
   
   count_
@@ -65,10 +66,16 @@ enum class PFGI : size_t {
   arr_mov_asgn,
   arr_idx_s,
   arr_idx_u,
+  /// Subscript without a bounds check
+  arr_idx,
   arr_len_ctor,
+  /// Copy immortal storage before it is modified. Returns the storage
+  arr_own,
   arr_strg_dtor,
   arr_eq,
   arr_lt,
+  /// FNV-1a hash of an array of chars. Used to dispatch switches on strings
+  arr_hash,
   
   srt_dtor,
   srt_def_ctor,
@@ -0,0 +1,317 @@
+//
+//  last use.cpp
+//  STELA
+//
+//  Created by Indi Kernick on 18/10/26.
+//  Copyright © 2026 Indi Kernick. All rights reserved.
+//
+
+#include "last use.hpp"
+
+#include <algorithm>
+#include "symbols.hpp"
+#include <unordered_map>
+#include "categories.hpp"
+#include "Utils/assert down cast.hpp"
+
+using namespace stela;
+
+namespace {
+
+/// Whether an argument of a call is passed by value
+bool byValue(ast::FuncCall &call, const size_t a) {
+  if (auto *func = dynamic_cast<ast::Func *>(call.definition)) {
+    return func->params[a].ref == ast::ParamRef::val;
+  } else if (auto *ext = dynamic_cast<ast::ExtFunc *>(call.definition)) {
+    return ext->params[a].ref == ast::ParamRef::val;
+  } else if (auto *btn = dynamic_cast<ast::BtnFunc *>(call.definition)) {
+    return a == 1 ||
+           btn->value == ast::BtnFuncEnum::capacity ||
+           btn->value == ast::BtnFuncEnum::size;
+  } else if (call.definition == nullptr) {
+    auto *type = assertDownCast<ast::FuncType>(call.func->exprType.get());
+    return type->params[a].ref == ast::ParamRef::val;
+  } else {
+    return false;
+  }
+}
+
+// The function body is visited in the order that it is executed. The most
+// recent uses of each variable are tracked and the uses that are not
+// followed by another use are marked when the variable goes out of scope.
+// Both branches of an if might contain the most recent use. A use before the
+// if is only the most recent if neither branch touches the variable. Uses
+// within a loop that the variable was declared outside of are never the last.
+//
+// A use can only be moved from if it's the only reference to the variable
+// in the statement. Otherwise, the variable might be bound to a reference
+// parameter of the same call.
+
+class Visitor final : public ast::Visitor {
+public:
+  void visit(ast::Block &block) override {
+    enterScope();
+    for (const ast::StatPtr &stat : block.nodes) {
+      stat->accept(*this);
+    }
+    leaveScope();
+  }
+  void visit(ast::If &fi) override {
+    visitStat(fi.cond.get());
+    const Locals before = locals;
+    visitBody(fi.body.get());
+    Locals troo = std::move(locals);
+    locals = before;
+    if (fi.elseBody) {
+      visitBody(fi.elseBody.get());
+    }
+    for (auto &[definition, fols] : locals) {
+      const Local &prev = before.at(definition);
+      const Local &tru = troo.at(definition);
+      const bool trooTouched = tru.touches != prev.touches;
+      const bool folsTouched = fols.touches != prev.touches;
+      if (!trooTouched && !folsTouched) {
+        continue;
+      }
+      // the uses before the if are followed by a use in one of the branches
+      if (!folsTouched) {
+        fols.uses.clear();
+      }
+      if (trooTouched) {
+        for (ast::Identifier *use : tru.uses) {
+          if (std::find(fols.uses.cbegin(), fols.uses.cend(), use) == fols.uses.cend()) {
+            fols.uses.push_back(use);
+          }
+        }
+      }
+      fols.touches += tru.touches - prev.touches;
+    }
+  }
+  void visit(ast::Switch &swich) override {
+    visitStat(swich.expr.get());
+    for (ast::SwitchCase &cse : swich.cases) {
+      if (cse.expr) {
+        visitStat(cse.expr.get());
+      }
+      visitBody(cse.body.get());
+    }
+  }
+  void visit(ast::Return &ret) override {
+    if (ret.expr) {
+      visitOperand(ret.expr.get());
+      endStat();
+    }
+  }
+  void visit(ast::While &wile) override {
+    ++loops;
+    visitStat(wile.cond.get());
+    visitBody(wile.body.get());
+    --loops;
+  }
+  void visit(ast::For &four) override {
+    enterScope();
+    if (four.init) {
+      four.init->accept(*this);
+    }
+    ++loops;
+    visitStat(four.cond.get());
+    visitBody(four.body.get());
+    if (four.incr) {
+      four.incr->accept(*this);
+    }
+    --loops;
+    leaveScope();
+  }
+  
+  void visit(ast::Var &var) override {
+    declare(var, var.expr.get());
+  }
+  void visit(ast::Let &let) override {
+    declare(let, let.expr.get());
+  }
+  void visit(ast::DeclAssign &assign) override {
+    declare(assign, assign.expr.get());
+  }
+  void visit(ast::Assign &assign) override {
+    // assigning to a variable that has been moved from is fine
+    auto *dst = dynamic_cast<ast::Identifier *>(assign.dst.get());
+    auto *src = dynamic_cast<ast::Identifier *>(assign.src.get());
+    if (!dst) {
+      assign.dst->accept(*this);
+    }
+    if (dst && src && dst->definition == src->definition) {
+      // an object cannot be moved into itself
+      src->accept(*this);
+    } else {
+      visitOperand(assign.src.get());
+    }
+    endStat();
+  }
+  void visit(ast::CompAssign &assign) override {
+    assign.dst->accept(*this);
+    visitStat(assign.src.get());
+  }
+  void visit(ast::IncrDecr &incrDecr) override {
+    visitStat(incrDecr.expr.get());
+  }
+  void visit(ast::CallAssign &assign) override {
+    visitStat(&assign.call);
+  }
+  
+  void visit(ast::BinaryExpr &expr) override {
+    expr.lhs->accept(*this);
+    expr.rhs->accept(*this);
+  }
+  void visit(ast::UnaryExpr &expr) override {
+    expr.expr->accept(*this);
+  }
+  void visit(ast::FuncCall &call) override {
+    call.func->accept(*this);
+    for (size_t a = 0; a != call.args.size(); ++a) {
+      if (byValue(call, a)) {
+        visitOperand(call.args[a].get());
+      } else {
+        call.args[a]->accept(*this);
+      }
+    }
+  }
+  void visit(ast::MemberIdent &mem) override {
+    mem.object->accept(*this);
+  }
+  void visit(ast::Subscript &sub) override {
+    sub.object->accept(*this);
+    sub.index->accept(*this);
+  }
+  void visit(ast::Identifier &ident) override {
+    use(ident, false);
+  }
+  void visit(ast::Ternary &tern) override {
+    tern.cond->accept(*this);
+    tern.troo->accept(*this);
+    tern.fols->accept(*this);
+  }
+  void visit(ast::Make &make) override {
+    make.expr->accept(*this);
+  }
+  void visit(ast::ArrayLiteral &arr) override {
+    for (const ast::ExprPtr &expr : arr.exprs) {
+      visitOperand(expr.get());
+    }
+  }
+  void visit(ast::InitList &list) override {
+    for (const ast::ExprPtr &expr : list.exprs) {
+      visitOperand(expr.get());
+    }
+  }
+  void visit(ast::Lambda &lambda) override {
+    for (const sym::ClosureCap &cap : lambda.symbol->captures) {
+      auto local = locals.find(cap.object);
+      if (local != locals.end()) {
+        local->second.uses.clear();
+        ++local->second.touches;
+        ++refs[cap.object];
+      }
+    }
+  }
+  
+  void declareParam(ast::FuncParam &param) {
+    if (param.ref == ast::ParamRef::val) {
+      declare(param, nullptr);
+    }
+  }
+  void enterScope() {
+    scopes.emplace_back();
+  }
+  void leaveScope() {
+    for (ast::Statement *definition : scopes.back()) {
+      for (ast::Identifier *use : locals.at(definition).uses) {
+        use->lastUse = true;
+      }
+      locals.erase(definition);
+    }
+    scopes.pop_back();
+  }
+
+private:
+  struct Local {
+    size_t loops;
+    std::vector<ast::Identifier *> uses;
+    // the number of times the variable has been used
+    size_t touches = 0;
+  };
+  using Locals = std::unordered_map<ast::Statement *, Local>;
+  
+  Locals locals;
+  std::vector<std::vector<ast::Statement *>> scopes;
+  // the number of references to each variable in the current statement
+  std::unordered_map<ast::Statement *, size_t> refs;
+  size_t loops = 0;
+  
+  void declare(ast::Statement &definition, ast::Expression *expr) {
+    if (expr) {
+      visitOperand(expr);
+      endStat();
+    }
+    locals.insert({&definition, {loops, {}}});
+    scopes.back().push_back(&definition);
+  }
+  
+  void use(ast::Identifier &ident, const bool movable) {
+    if (ident.captureIndex != ~uint32_t{}) {
+      return;
+    }
+    auto local = locals.find(ident.definition);
+    if (local == locals.end()) {
+      return;
+    }
+    ++refs[ident.definition];
+    local->second.uses.clear();
+    ++local->second.touches;
+    if (movable && local->second.loops == loops) {
+      if (classifyType(ident.exprType.get()) != TypeCat::trivially_copyable) {
+        local->second.uses.push_back(&ident);
+      }
+    }
+  }
+  
+  /// Visit an expression that initializes an object or is assigned to one
+  void visitOperand(ast::Expression *expr) {
+    if (auto *ident = dynamic_cast<ast::Identifier *>(expr)) {
+      use(*ident, true);
+    } else {
+      expr->accept(*this);
+    }
+  }
+  void visitStat(ast::Expression *expr) {
+    expr->accept(*this);
+    endStat();
+  }
+  void visitBody(ast::Statement *body) {
+    enterScope();
+    body->accept(*this);
+    leaveScope();
+  }
+  void endStat() {
+    for (const auto &[definition, count] : refs) {
+      if (count > 1) {
+        locals.at(definition).uses.clear();
+      }
+    }
+    refs.clear();
+  }
+};
+
+}
+
+void stela::markLastUses(ast::Receiver &rec, ast::FuncParams &params, ast::Block &block) {
+  Visitor visitor;
+  visitor.enterScope();
+  if (rec) {
+    visitor.declareParam(*rec);
+  }
+  for (ast::FuncParam &param : params) {
+    visitor.declareParam(param);
+  }
+  visitor.visit(block);
+  visitor.leaveScope();
+}
@@ -0,0 +1,23 @@
+//
+//  last use.hpp
+//  STELA
+//
+//  Created by Indi Kernick on 18/10/26.
+//  Copyright © 2026 Indi Kernick. All rights reserved.
+//
+
+#ifndef stela_last_use_hpp
+#define stela_last_use_hpp
+
+#include "ast.hpp"
+
+namespace stela {
+
+/// Mark the identifiers that are the last use of a local variable or a
+/// parameter so that they are moved from instead of copied. Only the uses
+/// that initialize a new object or are assigned to another object are moved
+void markLastUses(ast::Receiver &, ast::FuncParams &, ast::Block &);
+
+}
+
+#endif
@@ -0,0 +1,175 @@
+//
+//  lazy engine.cpp
+//  STELA
+//
+//  Created by Indi Kernick on 18/10/26.
+//  Copyright © 2026 Indi Kernick. All rights reserved.
+//
+
+#include "lazy engine.hpp"
+
+#include "Log/log output.hpp"
+#include "target machine.hpp"
+#include "optimize module.hpp"
+#include "Utils/unreachable.hpp"
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/Support/DynamicLibrary.h>
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/ExecutionEngine/GenericValue.h>
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
+
+using namespace stela;
+
+namespace {
+
+/// ExecutionEngine adapter over LLLazyJIT so that getFunc and getGlobal work
+/// on either backend
+class LazyEngine final : public llvm::ExecutionEngine {
+public:
+  LazyEngine(
+    std::unique_ptr<llvm::TargetMachine> machine,
+    std::unique_ptr<llvm::orc::LLLazyJIT> jit
+  ) : llvm::ExecutionEngine{jit->getDataLayout()},
+      machine{std::move(machine)},
+      jit{std::move(jit)} {}
+  
+  llvm::GenericValue runFunction(llvm::Function *, llvm::ArrayRef<llvm::GenericValue>) override {
+    UNREACHABLE();
+  }
+  void *getPointerToNamedFunction(llvm::StringRef name, bool) override {
+    return reinterpret_cast<void *>(lookup(name));
+  }
+  void *getPointerToFunction(llvm::Function *func) override {
+    return getPointerToNamedFunction(func->getName(), false);
+  }
+  uint64_t getGlobalValueAddress(const std::string &name) override {
+    return lookup(name);
+  }
+  uint64_t getFunctionAddress(const std::string &name) override {
+    return lookup(name);
+  }
+  void runStaticConstructorsDestructors(const bool isDtors) override {
+    llvm::Error err = isDtors ? jit->runDestructors() : jit->runConstructors();
+    llvm::cantFail(std::move(err));
+  }
+
+private:
+  // the transform in the JIT refers to the machine
+  std::unique_ptr<llvm::TargetMachine> machine;
+  std::unique_ptr<llvm::orc::LLLazyJIT> jit;
+  
+  uint64_t lookup(const llvm::StringRef name) {
+    // MCJIT returns 0 for unknown symbols
+    auto symbol = jit->lookup(name);
+    if (symbol) {
+      return symbol->getAddress();
+    } else {
+      llvm::consumeError(symbol.takeError());
+      return 0;
+    }
+  }
+};
+
+/// Resolve symbols in the host process. This includes symbols added with
+/// sys::DynamicLibrary::AddSymbol (such as reflected functions)
+llvm::orc::SymbolNameSet searchProcess(
+  llvm::orc::JITDylib &dylib,
+  const llvm::orc::SymbolNameSet &names,
+  const char prefix
+) {
+  llvm::orc::SymbolMap symbols;
+  llvm::orc::SymbolNameSet found;
+  for (const llvm::orc::SymbolStringPtr &name : names) {
+    llvm::StringRef str = *name;
+    if (prefix != '\0') {
+      if (str.empty() || str.front() != prefix) {
+        continue;
+      }
+      str = str.drop_front();
+    }
+    void *addr = llvm::sys::DynamicLibrary::SearchForAddressOfSymbol(str.str());
+    if (addr) {
+      symbols[name] = llvm::JITEvaluatedSymbol{
+        static_cast<llvm::JITTargetAddress>(reinterpret_cast<uintptr_t>(addr)),
+        llvm::JITSymbolFlags::Exported
+      };
+      found.insert(name);
+    }
+  }
+  if (!symbols.empty()) {
+    llvm::cantFail(dylib.define(llvm::orc::absoluteSymbols(std::move(symbols))));
+  }
+  return found;
+}
+
+/// ORC needs to own the context of the modules it compiles so the module is
+/// moved into a fresh context by round-tripping through bitcode
+llvm::orc::ThreadSafeModule moveToNewContext(const llvm::Module &module, Log &log) {
+  llvm::SmallVector<char, 0> buffer;
+  llvm::raw_svector_ostream stream{buffer};
+  llvm::WriteBitcodeToFile(module, stream);
+  
+  auto context = std::make_unique<llvm::LLVMContext>();
+  const llvm::MemoryBufferRef ref{
+    llvm::StringRef{buffer.data(), buffer.size()}, module.getModuleIdentifier()
+  };
+  auto copy = llvm::parseBitcodeFile(ref, *context);
+  if (!copy) {
+    log.error() << llvm::toString(copy.takeError()) << fatal;
+  }
+  return llvm::orc::ThreadSafeModule{std::move(*copy), std::move(context)};
+}
+
+template <typename Value>
+Value check(llvm::Expected<Value> value, Log &log) {
+  if (!value) {
+    log.error() << llvm::toString(value.takeError()) << fatal;
+  }
+  return std::move(*value);
+}
+
+void check(llvm::Error err, Log &log) {
+  if (err) {
+    log.error() << llvm::toString(std::move(err)) << fatal;
+  }
+}
+
+}
+
+llvm::ExecutionEngine *stela::generateLazy(
+  std::unique_ptr<llvm::Module> module,
+  Log &log,
+  const OptFlags opt
+) {
+  auto builder = check(llvm::orc::JITTargetMachineBuilder::detectHost(), log);
+  builder.setCodeGenOptLevel(codeGenOpt(opt));
+  builder.setCPU(targetCPU(opt));
+  builder.getFeatures() = {};
+  builder.addFeatures(targetFeatures(opt));
+  auto machine = check(builder.createTargetMachine(), log);
+  const llvm::DataLayout layout = machine->createDataLayout();
+  auto jit = check(llvm::orc::LLLazyJIT::Create(builder, layout, 0), log);
+  
+  const char prefix = layout.getGlobalPrefix();
+  jit->getMainJITDylib().setGenerator([prefix](
+    llvm::orc::JITDylib &dylib,
+    const llvm::orc::SymbolNameSet &names
+  ) {
+    return searchProcess(dylib, names, prefix);
+  });
+  
+  if (opt.optimizeIR) {
+    // functions are optimized one at a time as they are pulled in
+    jit->setLazyCompileTransform([machine = machine.get(), opt](
+      llvm::orc::ThreadSafeModule module,
+      const llvm::orc::MaterializationResponsibility &
+    ) -> llvm::Expected<llvm::orc::ThreadSafeModule> {
+      optimizeModule(machine, module.getModule(), opt);
+      return std::move(module);
+    });
+  }
+  
+  check(jit->addLazyIRModule(moveToNewContext(*module, log)), log);
+  return new LazyEngine{std::move(machine), std::move(jit)};
+}
@@ -0,0 +1,25 @@
+//
+//  lazy engine.hpp
+//  STELA
+//
+//  Created by Indi Kernick on 18/10/26.
+//  Copyright © 2026 Indi Kernick. All rights reserved.
+//
+
+#ifndef stela_lazy_engine_hpp
+#define stela_lazy_engine_hpp
+
+#include "code generation.hpp"
+
+namespace stela {
+
+class Log;
+
+/// Create an ORC engine that compiles each function the first time it is
+/// called. The returned engine only supports the subset of the
+/// ExecutionEngine interface used by binding.hpp
+llvm::ExecutionEngine *generateLazy(std::unique_ptr<llvm::Module>, Log &, OptFlags);
+
+}
+
+#endif
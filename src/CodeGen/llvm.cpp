@@ -8,15 +8,20 @@
 
 #include "llvm.hpp"
 
-#include <memory>
+#include <mutex>
+#include <atomic>
 #include <cassert>
+#include <algorithm>
 #include <llvm/IR/LLVMContext.h>
+#include "func instantiations.hpp"
 #include <llvm/Support/TargetSelect.h>
 #include <llvm/IR/LegacyPassManager.h>
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
 
 namespace {
 
-std::unique_ptr<llvm::LLVMContext> globalContext;
+std::once_flag initFlag;
+std::atomic<bool> initialized = false;
 
 void initializeOptimizers() {
   llvm::PassRegistry &registry = *llvm::PassRegistry::getPassRegistry();
@@ -54,26 +59,48 @@ void initializeOptimizers() {
 }
 
 void stela::initLLVM() {
-  llvm::InitializeNativeTarget();
-  llvm::InitializeNativeTargetAsmPrinter();
-  llvm::InitializeNativeTargetAsmParser();
-  
-  assert(!globalContext);
-  globalContext = std::make_unique<llvm::LLVMContext>();
-  
-  initializeOptimizers();
+  std::call_once(initFlag, [] {
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+    llvm::InitializeNativeTargetAsmParser();
+    initializeOptimizers();
+    initialized = true;
+  });
 }
 
-void stela::quitLLVM() {
-  assert(globalContext);
-  globalContext.reset();
+bool stela::hasLLVM() {
+  return initialized;
 }
 
-llvm::LLVMContext &stela::getLLVM() {
-  assert(globalContext);
-  return *globalContext;
+stela::CompileCtx::CompileCtx()
+  : context{std::make_unique<llvm::LLVMContext>()} {}
+
+stela::CompileCtx::~CompileCtx() = default;
+
+llvm::LLVMContext &stela::CompileCtx::llvm() {
+  return *context;
 }
 
-bool stela::hasLLVM() {
-  return bool{globalContext};
+stela::FuncInst &stela::CompileCtx::resetInst(
+  llvm::Module *module,
+  const Allocator *alloc,
+  const bool atomicRefs
+) {
+  inst = std::make_unique<FuncInst>(module, alloc, atomicRefs);
+  return *inst;
+}
+
+llvm::ExecutionEngine *stela::CompileCtx::addEngine(llvm::ExecutionEngine *engine) {
+  // the instantiations refer to the module that the engine now owns
+  inst.reset();
+  engines.emplace_back(engine);
+  return engine;
+}
+
+void stela::CompileCtx::destroyEngine(llvm::ExecutionEngine *engine) {
+  const auto iter = std::find_if(engines.cbegin(), engines.cend(), [engine](const auto &owned) {
+    return owned.get() == engine;
+  });
+  assert(iter != engines.cend());
+  engines.erase(iter);
 }
@@ -0,0 +1,146 @@
+//
+//  object cache.cpp
+//  STELA
+//
+//  Created by Indi Kernick on 18/10/26.
+//  Copyright © 2026 Indi Kernick. All rights reserved.
+//
+
+#include "object cache.hpp"
+
+#include <algorithm>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/MD5.h>
+#include "target machine.hpp"
+#include <llvm/ADT/StringMap.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Config/llvm-config.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Support/MemoryBuffer.h>
+
+using namespace stela;
+
+DiskCache::DiskCache(std::string dir)
+  : dir{std::move(dir)} {
+  llvm::sys::fs::create_directories(this->dir);
+}
+
+void DiskCache::notifyObjectCompiled(const llvm::Module *module, llvm::MemoryBufferRef object) {
+  // the code would refer to addresses in this process
+  if (hasHostAddresses(*module)) {
+    return;
+  }
+  // Write to a temporary file and then rename it so that other processes
+  // sharing the directory never see a partially written object file
+  int fd;
+  llvm::SmallString<128> tempPath;
+  if (llvm::sys::fs::createUniqueFile(dir + "/%%%%%%%%.tmp", fd, tempPath)) {
+    return;
+  }
+  {
+    llvm::raw_fd_ostream stream{fd, true};
+    stream << object.getBuffer();
+    if (stream.has_error()) {
+      stream.clear_error();
+      llvm::sys::fs::remove(tempPath);
+      return;
+    }
+  }
+  if (llvm::sys::fs::rename(tempPath, objectPath(module))) {
+    llvm::sys::fs::remove(tempPath);
+  }
+}
+
+std::unique_ptr<llvm::MemoryBuffer> DiskCache::getObject(const llvm::Module *module) {
+  if (hasHostAddresses(*module)) {
+    return nullptr;
+  }
+  auto buffer = llvm::MemoryBuffer::getFile(objectPath(module), -1, false);
+  if (buffer) {
+    return std::move(*buffer);
+  } else {
+    return nullptr;
+  }
+}
+
+std::string DiskCache::objectPath(const llvm::Module *module) const {
+  return dir + "/" + module->getModuleIdentifier() + ".o";
+}
+
+namespace {
+
+uint8_t packFlags(const OptFlags opt) {
+  return static_cast<uint8_t>(
+    (opt.inliner << 0) |
+    (opt.vectorize << 1) |
+    (opt.optimizeIR << 2) |
+    (opt.optimizeASM << 3) |
+    (opt.instrument << 4) |
+    (static_cast<int>(opt.preset) << 5) |
+    (opt.elideRefCounts << 7)
+  );
+}
+
+/// Hash the length before the string so that adjacent strings can't be split
+/// differently and give the same hash
+void hashString(llvm::MD5 &hash, const llvm::StringRef str) {
+  uint64_t size = str.size();
+  hash.update({reinterpret_cast<const uint8_t *>(&size), sizeof(size)});
+  hash.update(str);
+}
+
+/// A string that might be null is preceded by a flag
+void hashOptional(llvm::MD5 &hash, const char *str) {
+  hash.update(uint8_t{str != nullptr});
+  if (str) {
+    hashString(hash, str);
+  }
+}
+
+}
+
+std::string stela::moduleKey(const llvm::Module &module, const OptFlags opt) {
+  std::string ir;
+  llvm::raw_string_ostream irStream{ir};
+  module.print(irStream, nullptr);
+  irStream.flush();
+
+  llvm::MD5 hash;
+  hashString(hash, ir);
+  hash.update(packFlags(opt));
+  hash.update(uint8_t{opt.profile != nullptr});
+  if (opt.profile) {
+    // the same path may hold a newer profile
+    if (auto profile = llvm::MemoryBuffer::getFile(opt.profile)) {
+      hashString(hash, (*profile)->getBuffer());
+    }
+  }
+  hashOptional(hash, opt.cpu);
+  hashOptional(hash, opt.features);
+  hashString(hash, LLVM_VERSION_STRING);
+  hashString(hash, llvm::sys::getProcessTriple());
+  hashString(hash, llvm::sys::getHostCPUName());
+  llvm::StringMap<bool> features;
+  if (llvm::sys::getHostCPUFeatures(features)) {
+    // StringMap iteration order is unspecified
+    std::vector<std::string> enabled;
+    for (const auto &feature : features) {
+      if (feature.getValue()) {
+        enabled.push_back(feature.getKey().str());
+      }
+    }
+    std::sort(enabled.begin(), enabled.end());
+    for (const std::string &feature : enabled) {
+      hashString(hash, feature);
+    }
+  }
+
+  llvm::MD5::MD5Result result;
+  hash.final(result);
+  return result.digest().str().str();
+}
+
+std::unique_ptr<llvm::ObjectCache> stela::makeObjectCache(std::string dir) {
+  return std::make_unique<DiskCache>(std::move(dir));
+}
@@ -0,0 +1,39 @@
+//
+//  object cache.hpp
+//  STELA
+//
+//  Created by Indi Kernick on 18/10/26.
+//  Copyright © 2026 Indi Kernick. All rights reserved.
+//
+
+#ifndef stela_object_cache_hpp
+#define stela_object_cache_hpp
+
+#include "code generation.hpp"
+#include <llvm/ExecutionEngine/ObjectCache.h>
+
+namespace stela {
+
+/// Stores object files in a directory. The module identifier is used as the
+/// file name so it should be set to the result of moduleKey before the module
+/// is handed to the engine
+class DiskCache final : public llvm::ObjectCache {
+public:
+  explicit DiskCache(std::string);
+
+  void notifyObjectCompiled(const llvm::Module *, llvm::MemoryBufferRef) override;
+  std::unique_ptr<llvm::MemoryBuffer> getObject(const llvm::Module *) override;
+
+private:
+  std::string dir;
+
+  std::string objectPath(const llvm::Module *) const;
+};
+
+/// Hash of the IR, the optimization flags and the host CPU. Two modules with
+/// the same key will produce the same machine code
+std::string moduleKey(const llvm::Module &, OptFlags);
+
+}
+
+#endif
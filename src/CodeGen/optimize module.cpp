@@ -8,49 +8,95 @@
 
 #include "optimize module.hpp"
 
+#include <chrono>
+#include "profile.hpp"
 #include <llvm/IR/Verifier.h>
+#include "target machine.hpp"
+#include "refcount elision.hpp"
 #include "Utils/unreachable.hpp"
-#include <llvm/Transforms/IPO.h>
 #include <llvm/Passes/PassBuilder.h>
-#include <llvm/IR/LegacyPassManager.h>
 #include <llvm/Target/TargetMachine.h>
+#include <llvm/IR/PassInstrumentation.h>
 #include <llvm/Transforms/IPO/GlobalDCE.h>
 #include <llvm/Transforms/Utils/CtorUtils.h>
-#include <llvm/Analysis/TargetLibraryInfo.h>
-#include <llvm/Analysis/TargetTransformInfo.h>
-#include <llvm/Transforms/IPO/PassManagerBuilder.h>
+
+using namespace stela;
 
 namespace {
 
-void addOptPasses(
-  llvm::legacy::PassManagerBase &passes,
-  llvm::legacy::FunctionPassManager &fnPasses,
-  llvm::TargetMachine *machine,
-  const stela::OptFlags opt
-) {
-  llvm::PassManagerBuilder builder;
-  builder.OptLevel = 3;
-  builder.SizeLevel = 0;
-  if (opt.inliner) {
-    builder.Inliner = llvm::createFunctionInliningPass(3, 0, false);
-  }
-  builder.LoopVectorize = opt.vectorize;
-  builder.SLPVectorize = opt.vectorize;
-  builder.NewGVN = true;
-  builder.PrepareForLTO = true;
-  machine->adjustPassManager(builder);
+using Clock = std::chrono::steady_clock;
+
+/// Skips the passes that are disabled by the flags and measures the time
+/// spent in each pass excluding the passes nested within it
+class PassObserver {
+public:
+  PassObserver(const OptFlags opt, PassTimings *timings)
+    : opt{opt}, timings{timings} {}
   
-  builder.populateFunctionPassManager(fnPasses);
-  builder.populateModulePassManager(passes);
-}
+  void attach(llvm::PassInstrumentationCallbacks &callbacks) {
+    callbacks.registerBeforePassCallback([this](llvm::StringRef pass, llvm::Any) {
+      return before(pass);
+    });
+    callbacks.registerAfterPassCallback([this](llvm::StringRef pass, llvm::Any) {
+      after(pass);
+    });
+    callbacks.registerAfterPassInvalidatedCallback([this](llvm::StringRef pass) {
+      after(pass);
+    });
+  }
 
-void addLinkPasses(llvm::legacy::PassManagerBase &passes, stela::OptFlags opt) {
-  llvm::PassManagerBuilder builder;
-  builder.PrepareForLTO = true;
-  if (opt.inliner) {
-    builder.Inliner = llvm::createFunctionInliningPass(3, 0, false);
+private:
+  struct Running {
+    llvm::StringRef pass;
+    Clock::time_point start;
+    Clock::duration nested;
+  };
+  
+  OptFlags opt;
+  PassTimings *timings;
+  std::vector<Running> stack;
+  
+  bool before(const llvm::StringRef pass) {
+    if (!opt.inliner && pass == "InlinerPass") {
+      return false;
+    }
+    if (!opt.vectorize && (pass == "LoopVectorizePass" || pass == "SLPVectorizerPass")) {
+      return false;
+    }
+    if (timings) {
+      stack.push_back({pass, Clock::now(), Clock::duration::zero()});
+    }
+    return true;
+  }
+  
+  void after(llvm::StringRef) {
+    if (!timings) {
+      return;
+    }
+    const Running running = stack.back();
+    stack.pop_back();
+    const Clock::duration total = Clock::now() - running.start;
+    if (!stack.empty()) {
+      stack.back().nested += total;
+    }
+    addTiming(*timings, {
+      running.pass.str(),
+      std::chrono::duration_cast<std::chrono::nanoseconds>(total - running.nested),
+      1
+    });
   }
-  builder.populateLTOPassManager(passes);
+};
+
+llvm::PassBuilder::OptimizationLevel optLevel(const OptPreset preset) {
+  switch (preset) {
+    case OptPreset::compile_time:
+      return llvm::PassBuilder::O1;
+    case OptPreset::balanced:
+      return llvm::PassBuilder::O2;
+    case OptPreset::max_throughput:
+      return llvm::PassBuilder::O3;
+  }
+  UNREACHABLE();
 }
 
 bool shouldRemoveCtor(llvm::Function *ctor) {
@@ -75,54 +121,72 @@ std::unique_ptr<Module> getLazyIRFileModule(StringRef, SMDiagnostic &, LLVMConte
 
 }
 
+void stela::addTiming(PassTimings &timings, PassTime time) {
+  for (PassTime &existing : timings) {
+    if (existing.name == time.name) {
+      existing.time += time.time;
+      existing.runs += time.runs;
+      return;
+    }
+  }
+  timings.push_back(std::move(time));
+}
+
 void stela::optimizeModule(
   llvm::TargetMachine *machine,
   llvm::Module *module,
-  const OptFlags opt
+  const OptFlags opt,
+  PassTimings *timings
 ) {
-  module->setTargetTriple(machine->getTargetTriple().str());
-  module->setDataLayout(machine->createDataLayout());
-  
-  /*
+  setTarget(*module, *machine);
   
-  // need to link /usr/local/opt/llvm/lib/libLLVMPasses.a
-  // crashes in ModuleAnalysisManager destructor
-  
-  llvm::ModuleAnalysisManager MAM;
-  llvm::FunctionAnalysisManager FAM;
-  llvm::LoopAnalysisManager LAM;
-  llvm::CGSCCAnalysisManager CGAM;
-  llvm::PassBuilder PB;
+  // The profile is matched to the control flow graph of each function so
+  // counters are inserted and read before the IR is changed
+  if (opt.instrument) {
+    instrumentModule(module);
+  } else if (opt.profile) {
+    applyProfile(module, opt.profile);
+  }
   
-  PB.registerModuleAnalyses(MAM);
-  PB.registerFunctionAnalyses(FAM);
-  PB.registerLoopAnalyses(LAM);
-  PB.registerCGSCCAnalyses(CGAM);
-  PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+  llvm::PassInstrumentationCallbacks callbacks;
+  PassObserver observer{opt, timings};
+  observer.attach(callbacks);
+  llvm::PassBuilder builder{machine, llvm::None, &callbacks};
   
-  auto MPM = PB.buildModuleOptimizationPipeline(llvm::PassBuilder::O3);
-  MPM.run(*module, MAM);
+  // the analysis managers refer to each other through proxies so they must
+  // be destroyed in this order
+  llvm::LoopAnalysisManager loopAnalyses;
+  llvm::FunctionAnalysisManager funcAnalyses;
+  llvm::CGSCCAnalysisManager cgsccAnalyses;
+  llvm::ModuleAnalysisManager moduleAnalyses;
+  builder.registerModuleAnalyses(moduleAnalyses);
+  builder.registerCGSCCAnalyses(cgsccAnalyses);
+  builder.registerFunctionAnalyses(funcAnalyses);
+  builder.registerLoopAnalyses(loopAnalyses);
+  builder.crossRegisterProxies(loopAnalyses, funcAnalyses, cgsccAnalyses, moduleAnalyses);
   
-  */
-
-  llvm::legacy::PassManager passes;
-  passes.add(new llvm::TargetLibraryInfoWrapperPass(machine->getTargetTriple()));
-  passes.add(llvm::createTargetTransformInfoWrapperPass(machine->getTargetIRAnalysis()));
-
-  llvm::legacy::FunctionPassManager fnPasses(module);
-  fnPasses.add(llvm::createTargetTransformInfoWrapperPass(machine->getTargetIRAnalysis()));
-
-  addOptPasses(passes, fnPasses, machine, opt);
-  addLinkPasses(passes, opt);
-
-  fnPasses.doInitialization();
-  for (llvm::Function &func : *module) {
-    fnPasses.run(func);
+  llvm::ModulePassManager passes;
+  if (opt.inliner && opt.elideRefCounts) {
+    addRefCountElision(passes);
   }
-  fnPasses.doFinalization();
-
-  passes.add(llvm::createVerifierPass());
-  passes.run(*module);
+  passes.addPass(builder.buildPerModuleDefaultPipeline(optLevel(opt.preset)));
+  passes.addPass(llvm::VerifierPass{});
+  passes.run(*module, moduleAnalyses);
   
   //llvm::optimizeGlobalCtorsList(*module, &shouldRemoveCtor);
 }
+
+llvm::CodeGenOpt::Level stela::codeGenOpt(const OptFlags opt) {
+  if (!opt.optimizeASM) {
+    return llvm::CodeGenOpt::None;
+  }
+  switch (opt.preset) {
+    case OptPreset::compile_time:
+      return llvm::CodeGenOpt::Less;
+    case OptPreset::balanced:
+      return llvm::CodeGenOpt::Default;
+    case OptPreset::max_throughput:
+      return llvm::CodeGenOpt::Aggressive;
+  }
+  UNREACHABLE();
+}
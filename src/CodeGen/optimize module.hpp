@@ -10,6 +10,7 @@
 #define stela_optimize_module_hpp
 
 #include "code generation.hpp"
+#include <llvm/Support/CodeGen.h>
 
 namespace llvm {
 
@@ -20,7 +21,10 @@ class Module;
 
 namespace stela {
 
-void optimizeModule(llvm::TargetMachine *, llvm::Module *, OptFlags);
+void optimizeModule(llvm::TargetMachine *, llvm::Module *, OptFlags, PassTimings * = nullptr);
+llvm::CodeGenOpt::Level codeGenOpt(OptFlags);
+/// Add the time to the pass with the same name
+void addTiming(PassTimings &, PassTime);
 
 }
 
@@ -0,0 +1,162 @@
+//
+//  parallel engine.cpp
+//  STELA
+//
+//  Created by Indi Kernick on 18/10/26.
+//  Copyright © 2026 Indi Kernick. All rights reserved.
+//
+
+#include "parallel engine.hpp"
+
+#include "generate file.hpp"
+#include "Log/log output.hpp"
+#include <llvm/IR/Constants.h>
+#include "target machine.hpp"
+#include "optimize module.hpp"
+#include <llvm/Object/ObjectFile.h>
+#include <llvm/Support/ThreadPool.h>
+#include <llvm/Target/TargetMachine.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/ExecutionEngine/MCJIT.h>
+#include <llvm/Transforms/Utils/SplitModule.h>
+
+using namespace stela;
+
+namespace {
+
+struct Part {
+  llvm::SmallVector<char, 0> bitcode;
+  llvm::SmallVector<char, 0> object;
+  std::unique_ptr<llvm::TargetMachine> machine;
+  PassTimings timings;
+  std::string error;
+};
+
+std::unique_ptr<llvm::TargetMachine> makeMachine(const OptFlags opt) {
+  return std::unique_ptr<llvm::TargetMachine>{
+    llvm::EngineBuilder{}.setOptLevel(codeGenOpt(opt))
+                         .setMCPU(targetCPU(opt))
+                         .setMAttrs(targetFeatures(opt))
+                         .selectTarget()
+  };
+}
+
+/// The constructor list of each partition would be ignored by MCJIT so the
+/// list is removed and the constructors are called by name after linking
+std::vector<std::string> takeCtors(llvm::Module &module) {
+  std::vector<std::string> names;
+  llvm::GlobalVariable *list = module.getNamedGlobal("llvm.global_ctors");
+  if (list == nullptr) {
+    return names;
+  }
+  if (auto *entries = llvm::dyn_cast<llvm::ConstantArray>(list->getInitializer())) {
+    for (llvm::Value *entry : entries->operands()) {
+      auto *ctor = llvm::cast<llvm::Function>(
+        llvm::cast<llvm::ConstantStruct>(entry)->getOperand(1)
+      );
+      ctor->setLinkage(llvm::GlobalObject::ExternalLinkage);
+      names.push_back(ctor->getName().str());
+    }
+  }
+  list->eraseFromParent();
+  return names;
+}
+
+/// Each partition is parsed into its own context so that the threads don't
+/// share any LLVM state
+void compilePart(Part &part, const OptFlags opt, const bool timed) {
+  llvm::LLVMContext context;
+  const llvm::MemoryBufferRef ref{
+    llvm::StringRef{part.bitcode.data(), part.bitcode.size()}, "part"
+  };
+  auto module = llvm::parseBitcodeFile(ref, context);
+  if (!module) {
+    part.error = llvm::toString(module.takeError());
+    return;
+  }
+  
+  // SplitModule externalizes internal functions so calls between partitions
+  // cannot be inlined
+  if (opt.optimizeIR) {
+    optimizeModule(part.machine.get(), module->get(), opt, timed ? &part.timings : nullptr);
+  }
+  
+  if (!emitObject(part.machine.get(), **module, part.object)) {
+    part.error = "Target cannot emit object files";
+  }
+}
+
+}
+
+llvm::ExecutionEngine *stela::generateParallel(
+  std::unique_ptr<llvm::Module> module,
+  Log &log,
+  const EngineOpts &opts
+) {
+  const OptFlags opt = opts.opt;
+  const unsigned threads = opts.threads;
+  log.status() << "Compiling on " << threads << " threads" << endlog;
+  
+  llvm::LLVMContext &context = module->getContext();
+  std::unique_ptr<llvm::TargetMachine> machine = makeMachine(opt);
+  if (machine == nullptr) {
+    log.error() << "Failed to create target machine" << fatal;
+  }
+  setTarget(*module, *machine);
+  const std::vector<std::string> ctors = takeCtors(*module);
+  
+  std::vector<Part> parts;
+  llvm::SplitModule(std::move(module), threads, [&](std::unique_ptr<llvm::Module> part) {
+    Part &back = parts.emplace_back();
+    llvm::raw_svector_ostream stream{back.bitcode};
+    llvm::WriteBitcodeToFile(*part, stream);
+    back.machine = makeMachine(opt);
+  });
+  
+  {
+    llvm::ThreadPool pool{threads};
+    for (Part &part : parts) {
+      pool.async([&part, opt, timed = opts.timings != nullptr] {
+        compilePart(part, opt, timed);
+      });
+    }
+    pool.wait();
+  }
+  
+  std::string str;
+  auto engine = llvm::EngineBuilder(std::make_unique<llvm::Module>("", context))
+                .setErrorStr(&str)
+                .setOptLevel(codeGenOpt(opt))
+                .setEngineKind(llvm::EngineKind::JIT)
+                .create();
+  if (engine == nullptr) {
+    log.error() << str << fatal;
+  }
+  
+  for (Part &part : parts) {
+    if (!part.error.empty()) {
+      log.error() << part.error << fatal;
+    }
+    if (opts.timings) {
+      for (PassTime &time : part.timings) {
+        addTiming(*opts.timings, std::move(time));
+      }
+    }
+    auto buffer = llvm::MemoryBuffer::getMemBufferCopy(
+      llvm::StringRef{part.object.data(), part.object.size()}
+    );
+    auto object = llvm::object::ObjectFile::createObjectFile(buffer->getMemBufferRef());
+    if (!object) {
+      log.error() << llvm::toString(object.takeError()) << fatal;
+    }
+    engine->addObjectFile({std::move(*object), std::move(buffer)});
+  }
+  engine->finalizeObject();
+  
+  for (const std::string &name : ctors) {
+    reinterpret_cast<void (*)()>(engine->getFunctionAddress(name))();
+  }
+  
+  return engine;
+}
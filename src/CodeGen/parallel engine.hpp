@@ -0,0 +1,25 @@
+//
+//  parallel engine.hpp
+//  STELA
+//
+//  Created by Indi Kernick on 18/10/26.
+//  Copyright © 2026 Indi Kernick. All rights reserved.
+//
+
+#ifndef stela_parallel_engine_hpp
+#define stela_parallel_engine_hpp
+
+#include "code generation.hpp"
+
+namespace stela {
+
+class Log;
+
+/// Split the module into partitions and then optimize and compile each
+/// partition on its own thread. The object files are linked into a single
+/// MCJIT engine and the static constructors are called
+llvm::ExecutionEngine *generateParallel(std::unique_ptr<llvm::Module>, Log &, const EngineOpts &);
+
+}
+
+#endif
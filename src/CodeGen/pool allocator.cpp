@@ -0,0 +1,402 @@
+//
+//  pool allocator.cpp
+//  STELA
+//
+//  Created by Indi Kernick on 18/10/26.
+//  Copyright © 2026 Indi Kernick. All rights reserved.
+//
+
+#include "allocator.hpp"
+
+#include <new>
+#include <array>
+#include <mutex>
+#include <atomic>
+#include <utility>
+#include <cstring>
+#include <algorithm>
+
+using namespace stela;
+
+struct alignas(16) stela::ArenaChunk {
+  std::atomic<size_t> count;
+  ArenaChunk *next;
+  size_t size;
+};
+
+namespace {
+
+// Each block starts with a tag that stores its size class so that a block can
+// be freed without its size. The tag is a whole granule so that the memory
+// after it is aligned like malloc. Blocks that are too big for a size class
+// are allocated with malloc and have a tag of large_class.
+//
+// Each thread caches free blocks of each size class. Blocks are moved between
+// the cache of a thread and the shared free lists in batches. The shared free
+// lists are refilled by splitting chunks. Chunks are never freed.
+//
+// Arena blocks are allocated by bumping a pointer through chunks that are
+// aligned to their size so that the chunk of a block can be found from its
+// address. Each chunk counts its live blocks plus one for the arena that
+// owns it. Freeing an arena block only decrements the count and the chunk is
+// released when the count reaches zero. Blocks that escape the arena keep
+// their chunk alive.
+
+constexpr size_t granule = 16;
+constexpr size_t class_count = 17;
+constexpr size_t max_pooled = (class_count - 1) * granule;
+constexpr size_t large_class = ~size_t{};
+constexpr size_t arena_class = large_class - 1;
+constexpr size_t chunk_size = 64 * 1024;
+constexpr size_t batch_size = 32;
+constexpr size_t cache_limit = 4 * batch_size;
+constexpr size_t arena_chunk_size = 64 * 1024;
+constexpr size_t spare_limit = 4;
+
+struct alignas(granule) Tag {
+  size_t sizeClass;
+  /// Only used by arena blocks
+  size_t size;
+};
+
+static_assert(sizeof(Tag) == granule);
+static_assert(alignof(ArenaChunk) == granule);
+
+struct FreeBlock {
+  FreeBlock *next;
+};
+
+size_t roundUp(const size_t size, const size_t align) {
+  return (size + align - 1) / align * align;
+}
+
+size_t classOf(const size_t size) {
+  return roundUp(size, granule) / granule;
+}
+
+size_t blockSize(const size_t sizeClass) {
+  return sizeof(Tag) + sizeClass * granule;
+}
+
+Tag *tagOf(void *const ptr) {
+  return static_cast<Tag *>(ptr) - 1;
+}
+
+void *payloadOf(Tag *const tag) {
+  return tag + 1;
+}
+
+FreeBlock *asFree(Tag *const tag) {
+  // a free block of class 0 has no room after the tag
+  return reinterpret_cast<FreeBlock *>(tag);
+}
+
+Tag *asTag(FreeBlock *const block, const size_t sizeClass) {
+  Tag *tag = reinterpret_cast<Tag *>(block);
+  tag->sizeClass = sizeClass;
+  return tag;
+}
+
+struct FreeList {
+  FreeBlock *head = nullptr;
+  size_t size = 0;
+  
+  void push(FreeBlock *const block) {
+    block->next = head;
+    head = block;
+    ++size;
+  }
+  FreeBlock *pop() {
+    FreeBlock *block = head;
+    head = block->next;
+    --size;
+    return block;
+  }
+  /// Move up to count blocks to another list
+  void moveTo(FreeList &other, const size_t count) {
+    for (size_t b = 0; b != count && head; ++b) {
+      other.push(pop());
+    }
+  }
+};
+
+struct SharedList {
+  std::mutex mutex;
+  FreeList list;
+};
+
+/// Split a new chunk into blocks
+bool refillFromChunk(FreeList &list, const size_t sizeClass) {
+  const size_t size = blockSize(sizeClass);
+  auto *chunk = static_cast<char *>(std::malloc(chunk_size));
+  if (!chunk) {
+    return false;
+  }
+  for (size_t offset = 0; offset + size <= chunk_size; offset += size) {
+    list.push(reinterpret_cast<FreeBlock *>(chunk + offset));
+  }
+  return true;
+}
+
+/// The shared lists are never destroyed because blocks might be freed by
+/// the destructors of other static objects
+std::array<SharedList, class_count> &sharedLists() {
+  static auto *lists = new std::array<SharedList, class_count>;
+  return *lists;
+}
+
+using Lists = std::array<FreeList, class_count>;
+
+/// The blocks cached by this thread. This is trivially destructible so that
+/// it can still be used while other thread local objects are destroyed
+thread_local Lists cache;
+/// Arena chunks of the normal size that can be reused
+thread_local ArenaChunk *spares = nullptr;
+thread_local size_t spareCount = 0;
+thread_local ArenaScope *currentArena = nullptr;
+thread_local bool exited = false;
+
+struct FlushOnExit {
+  ~FlushOnExit() {
+    for (size_t c = 0; c != class_count; ++c) {
+      SharedList &shared = sharedLists()[c];
+      std::lock_guard lock{shared.mutex};
+      cache[c].moveTo(shared.list, cache[c].size);
+    }
+    while (spares) {
+      std::free(std::exchange(spares, spares->next));
+    }
+    exited = true;
+  }
+};
+
+/// Whether this thread can cache memory. The caches are flushed when the
+/// thread exits
+bool canCache() {
+  if (exited) {
+    return false;
+  }
+  thread_local FlushOnExit flush;
+  return true;
+}
+
+/// The cache of this thread or null if the thread is exiting. Blocks are
+/// moved straight to the shared lists once the cache has been flushed
+FreeList *threadCache(const size_t sizeClass) {
+  return canCache() ? &cache[sizeClass] : nullptr;
+}
+
+void *allocateSmall(const size_t sizeClass) {
+  FreeList *list = threadCache(sizeClass);
+  if (!list || !list->head) {
+    SharedList &shared = sharedLists()[sizeClass];
+    std::lock_guard lock{shared.mutex};
+    if (!shared.list.head && !refillFromChunk(shared.list, sizeClass)) {
+      return nullptr;
+    }
+    if (!list) {
+      return payloadOf(asTag(shared.list.pop(), sizeClass));
+    }
+    shared.list.moveTo(*list, batch_size);
+  }
+  return payloadOf(asTag(list->pop(), sizeClass));
+}
+
+void deallocateSmall(Tag *const tag) {
+  const size_t sizeClass = tag->sizeClass;
+  FreeList *list = threadCache(sizeClass);
+  if (!list || list->size == cache_limit) {
+    SharedList &shared = sharedLists()[sizeClass];
+    std::lock_guard lock{shared.mutex};
+    if (!list) {
+      shared.list.push(asFree(tag));
+      return;
+    }
+    list->moveTo(shared.list, batch_size);
+  }
+  list->push(asFree(tag));
+}
+
+void *allocateLarge(const size_t size) {
+  auto *tag = static_cast<Tag *>(std::malloc(sizeof(Tag) + size));
+  if (!tag) {
+    return nullptr;
+  }
+  tag->sizeClass = large_class;
+  return payloadOf(tag);
+}
+
+void *heapAllocate(const size_t size) {
+  if (size > max_pooled) {
+    return allocateLarge(size);
+  }
+  return allocateSmall(classOf(size));
+}
+
+ArenaChunk *chunkOf(Tag *const tag) {
+  const auto addr = reinterpret_cast<uintptr_t>(tag);
+  return reinterpret_cast<ArenaChunk *>(addr & ~(arena_chunk_size - 1));
+}
+
+char *beginOf(ArenaChunk *const chunk) {
+  return reinterpret_cast<char *>(chunk + 1);
+}
+
+char *endOf(Tag *const tag) {
+  return static_cast<char *>(payloadOf(tag)) + roundUp(tag->size, granule);
+}
+
+/// Make a chunk with room for at least this many bytes of blocks
+ArenaChunk *makeChunk(const size_t bytes) {
+  const size_t size = roundUp(sizeof(ArenaChunk) + bytes, arena_chunk_size);
+  void *mem;
+  if (size == arena_chunk_size && spares) {
+    ArenaChunk *spare = std::exchange(spares, spares->next);
+    --spareCount;
+    mem = spare;
+  } else {
+    mem = std::aligned_alloc(arena_chunk_size, size);
+    if (!mem) {
+      return nullptr;
+    }
+  }
+  return new (mem) ArenaChunk{{1}, nullptr, size};
+}
+
+void releaseChunk(ArenaChunk *const chunk) {
+  if (chunk->count.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+    return;
+  }
+  if (chunk->size == arena_chunk_size && spareCount != spare_limit && canCache()) {
+    chunk->next = spares;
+    spares = chunk;
+    ++spareCount;
+  } else {
+    std::free(chunk);
+  }
+}
+
+}
+
+class stela::ArenaImpl {
+public:
+  static void *allocate(ArenaScope &arena, const size_t size) {
+    const size_t bytes = sizeof(Tag) + roundUp(size, granule);
+    Tag *tag;
+    if (bytes <= static_cast<size_t>(arena.end - arena.next)) {
+      tag = reinterpret_cast<Tag *>(arena.next);
+      arena.next += bytes;
+    } else {
+      ArenaChunk *chunk = makeChunk(bytes);
+      if (!chunk) {
+        return nullptr;
+      }
+      chunk->next = arena.chunks;
+      arena.chunks = chunk;
+      tag = reinterpret_cast<Tag *>(beginOf(chunk));
+      // the chunk of a block is found by rounding down its address so only
+      // chunks of the normal size are bumped through
+      if (chunk->size == arena_chunk_size) {
+        arena.next = beginOf(chunk) + bytes;
+        arena.end = reinterpret_cast<char *>(chunk) + arena_chunk_size;
+      }
+    }
+    tag->sizeClass = arena_class;
+    tag->size = size;
+    chunkOf(tag)->count.fetch_add(1, std::memory_order_relaxed);
+    return payloadOf(tag);
+  }
+  
+  /// Resize an arena block. The block is moved into the current arena or
+  /// out to the pool if there isn't one
+  static void *reallocate(ArenaScope *arena, Tag *const tag, const size_t size) {
+    void *ptr = payloadOf(tag);
+    if (arena && endOf(tag) == arena->next) {
+      // the most recent block can be resized in place
+      char *newEnd = static_cast<char *>(ptr) + roundUp(size, granule);
+      if (newEnd <= arena->end) {
+        arena->next = newEnd;
+        tag->size = size;
+        return ptr;
+      }
+    }
+    void *newPtr = arena ? allocate(*arena, size) : heapAllocate(size);
+    if (!newPtr) {
+      return nullptr;
+    }
+    std::memcpy(newPtr, ptr, std::min(tag->size, size));
+    releaseChunk(chunkOf(tag));
+    return newPtr;
+  }
+};
+
+stela::ArenaScope::ArenaScope() noexcept
+  : prev{currentArena} {
+  currentArena = this;
+}
+
+stela::ArenaScope::~ArenaScope() noexcept {
+  suspend();
+  while (chunks) {
+    releaseChunk(std::exchange(chunks, chunks->next));
+  }
+}
+
+void stela::ArenaScope::suspend() noexcept {
+  if (currentArena == this) {
+    currentArena = prev;
+  }
+}
+
+bool stela::isArenaBlock(const void *const ptr) noexcept {
+  return tagOf(const_cast<void *>(ptr))->sizeClass == arena_class;
+}
+
+void *stela::stela_pool_alloc(const size_t size) noexcept {
+  if (ArenaScope *arena = currentArena) {
+    return ArenaImpl::allocate(*arena, size);
+  }
+  return heapAllocate(size);
+}
+
+void stela::stela_pool_free(void *const ptr) noexcept {
+  if (!ptr) {
+    return;
+  }
+  Tag *tag = tagOf(ptr);
+  if (tag->sizeClass == large_class) {
+    std::free(tag);
+  } else if (tag->sizeClass == arena_class) {
+    releaseChunk(chunkOf(tag));
+  } else {
+    deallocateSmall(tag);
+  }
+}
+
+void *stela::stela_pool_realloc(void *const ptr, const size_t size) noexcept {
+  if (!ptr) {
+    return stela_pool_alloc(size);
+  }
+  Tag *tag = tagOf(ptr);
+  if (tag->sizeClass == arena_class) {
+    return ArenaImpl::reallocate(currentArena, tag, size);
+  }
+  // memory that was allocated before the arena stays out of it
+  if (tag->sizeClass == large_class && size > max_pooled) {
+    auto *newTag = static_cast<Tag *>(std::realloc(tag, sizeof(Tag) + size));
+    return newTag ? payloadOf(newTag) : nullptr;
+  }
+  if (tag->sizeClass != large_class && classOf(size) == tag->sizeClass) {
+    return ptr;
+  }
+  void *newPtr = heapAllocate(size);
+  if (!newPtr) {
+    return nullptr;
+  }
+  const size_t oldSize = tag->sizeClass == large_class
+                       ? max_pooled
+                       : tag->sizeClass * granule;
+  std::memcpy(newPtr, ptr, std::min(oldSize, size));
+  stela_pool_free(ptr);
+  return newPtr;
+}
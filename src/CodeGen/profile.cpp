@@ -0,0 +1,202 @@
+//
+//  profile.cpp
+//  STELA
+//
+//  Created by Indi Kernick on 18/10/26.
+//  Copyright © 2026 Indi Kernick. All rights reserved.
+//
+
+#include "profile.hpp"
+
+#include <llvm/IR/Module.h>
+#include "Log/log output.hpp"
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include <llvm/ProfileData/InstrProf.h>
+#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Transforms/Instrumentation.h>
+#include <llvm/ProfileData/InstrProfReader.h>
+#include <llvm/ProfileData/InstrProfWriter.h>
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
+#include <llvm/Transforms/Instrumentation/PGOInstrumentation.h>
+
+using namespace stela;
+
+namespace {
+
+/// Layout of each element of the table. This must match getEntryType
+struct ProfileEntry {
+  const char *name;
+  uint64_t nameSize;
+  uint64_t hash;
+  const uint64_t *counters;
+  uint64_t size;
+};
+
+llvm::StructType *getEntryType(llvm::LLVMContext &ctx) {
+  llvm::Type *i64 = llvm::Type::getInt64Ty(ctx);
+  return llvm::StructType::get(
+    llvm::Type::getInt8PtrTy(ctx), i64, i64, i64->getPointerTo(), i64
+  );
+}
+
+struct Counters {
+  llvm::GlobalVariable *name;
+  uint64_t hash;
+  llvm::GlobalVariable *array;
+};
+
+/// Lower the intrinsics inserted by PGOInstrumentationGen without the
+/// compiler-rt profile runtime. The counters are plain globals and the
+/// value profiling intrinsics are dropped
+std::vector<Counters> lowerIntrinsics(llvm::Module *module) {
+  llvm::LLVMContext &ctx = module->getContext();
+  llvm::Type *i64 = llvm::Type::getInt64Ty(ctx);
+  std::vector<Counters> counters;
+  std::vector<llvm::IntrinsicInst *> dead;
+  
+  for (llvm::Function &func : *module) {
+    for (llvm::BasicBlock &block : func) {
+      for (llvm::Instruction &inst : block) {
+        if (auto *valueProf = llvm::dyn_cast<llvm::InstrProfValueProfileInst>(&inst)) {
+          dead.push_back(valueProf);
+          continue;
+        }
+        auto *inc = llvm::dyn_cast<llvm::InstrProfIncrementInst>(&inst);
+        if (inc == nullptr) {
+          continue;
+        }
+        llvm::GlobalVariable *name = inc->getName();
+        auto iter = std::find_if(counters.begin(), counters.end(), [name](const Counters &c) {
+          return c.name == name;
+        });
+        if (iter == counters.end()) {
+          const uint64_t size = inc->getNumCounters()->getZExtValue();
+          llvm::ArrayType *arrayType = llvm::ArrayType::get(i64, size);
+          auto *array = new llvm::GlobalVariable{
+            *module,
+            arrayType,
+            false,
+            llvm::GlobalValue::PrivateLinkage,
+            llvm::ConstantAggregateZero::get(arrayType),
+            "prof.counters"
+          };
+          counters.push_back({name, inc->getHash()->getZExtValue(), array});
+          iter = std::prev(counters.end());
+        }
+        
+        llvm::IRBuilder<> ir{inc};
+        llvm::Value *addr = ir.CreateConstInBoundsGEP2_64(
+          iter->array, 0, inc->getIndex()->getZExtValue()
+        );
+        llvm::Value *count = ir.CreateLoad(addr);
+        ir.CreateStore(ir.CreateAdd(count, inc->getStep()), addr);
+        dead.push_back(inc);
+      }
+    }
+  }
+  
+  for (llvm::IntrinsicInst *inst : dead) {
+    inst->eraseFromParent();
+  }
+  return counters;
+}
+
+void writeTable(llvm::Module *module, const std::vector<Counters> &counters) {
+  llvm::LLVMContext &ctx = module->getContext();
+  llvm::Type *i64 = llvm::Type::getInt64Ty(ctx);
+  llvm::StructType *entryType = getEntryType(ctx);
+  std::vector<llvm::Constant *> entries;
+  for (const Counters &c : counters) {
+    const uint64_t nameSize = llvm::getPGOFuncNameVarInitializer(c.name).size();
+    entries.push_back(llvm::ConstantStruct::get(
+      entryType,
+      llvm::ConstantExpr::getPointerCast(c.name, llvm::Type::getInt8PtrTy(ctx)),
+      llvm::ConstantInt::get(i64, nameSize),
+      llvm::ConstantInt::get(i64, c.hash),
+      llvm::ConstantExpr::getPointerCast(c.array, i64->getPointerTo()),
+      llvm::ConstantInt::get(i64, c.array->getValueType()->getArrayNumElements())
+    ));
+  }
+  llvm::ArrayType *tableType = llvm::ArrayType::get(entryType, entries.size());
+  new llvm::GlobalVariable{
+    *module,
+    tableType,
+    true,
+    llvm::GlobalValue::ExternalLinkage,
+    llvm::ConstantArray::get(tableType, entries),
+    "stela.profile"
+  };
+  new llvm::GlobalVariable{
+    *module,
+    i64,
+    true,
+    llvm::GlobalValue::ExternalLinkage,
+    llvm::ConstantInt::get(i64, entries.size()),
+    "stela.profile.size"
+  };
+}
+
+}
+
+void stela::instrumentModule(llvm::Module *module) {
+  llvm::legacy::PassManager passes;
+  passes.add(llvm::createPGOInstrumentationGenLegacyPass());
+  passes.run(*module);
+  writeTable(module, lowerIntrinsics(module));
+}
+
+void stela::applyProfile(llvm::Module *module, const char *path) {
+  llvm::legacy::PassManager passes;
+  passes.add(llvm::createPGOInstrumentationUseLegacyPass(path));
+  passes.run(*module);
+}
+
+void stela::checkProfile(const OptFlags opt, Log &log) {
+  if (opt.profile == nullptr || !opt.optimizeIR) {
+    return;
+  }
+  auto reader = llvm::IndexedInstrProfReader::create(opt.profile);
+  if (!reader) {
+    log.error() << "Failed to read profile \"" << opt.profile << "\": "
+      << llvm::toString(reader.takeError()) << fatal;
+  }
+}
+
+void stela::writeProfile(
+  llvm::ExecutionEngine *engine,
+  const std::string &path,
+  LogSink &sink
+) {
+  Log log{sink, LogCat::generate};
+  log.status() << "Writing profile \"" << path << "\"" << endlog;
+  
+  const auto *size = reinterpret_cast<const uint64_t *>(
+    engine->getGlobalValueAddress("stela.profile.size")
+  );
+  const auto *table = reinterpret_cast<const ProfileEntry *>(
+    engine->getGlobalValueAddress("stela.profile")
+  );
+  if (size == nullptr || table == nullptr) {
+    log.error() << "Engine was not compiled with OptFlags::instrument" << fatal;
+  }
+  
+  llvm::InstrProfWriter writer;
+  for (const ProfileEntry &entry : llvm::makeArrayRef(table, *size)) {
+    writer.addRecord(llvm::NamedInstrProfRecord{
+      llvm::StringRef{entry.name, entry.nameSize},
+      entry.hash,
+      std::vector<uint64_t>{entry.counters, entry.counters + entry.size}
+    }, [&](llvm::Error err) {
+      log.warn() << llvm::toString(std::move(err)) << endlog;
+    });
+  }
+  
+  std::error_code code;
+  llvm::raw_fd_ostream file{path, code};
+  if (code) {
+    log.error() << "Failed to open \"" << path << "\": " << code.message() << fatal;
+  }
+  writer.write(file);
+}
@@ -0,0 +1,30 @@
+//
+//  profile.hpp
+//  STELA
+//
+//  Created by Indi Kernick on 18/10/26.
+//  Copyright © 2026 Indi Kernick. All rights reserved.
+//
+
+#ifndef stela_profile_hpp
+#define stela_profile_hpp
+
+#include "code generation.hpp"
+
+namespace stela {
+
+class Log;
+
+/// Insert block counters into the unoptimized module along with a table of
+/// counters that writeProfile reads
+void instrumentModule(llvm::Module *);
+/// Attach the branch weights and entry counts of a profile to the
+/// unoptimized module
+void applyProfile(llvm::Module *, const char *);
+/// Make sure that the profile in the flags can be read. This is checked
+/// before optimizeModule because LLVM exits if the profile is unreadable
+void checkProfile(OptFlags, Log &);
+
+}
+
+#endif
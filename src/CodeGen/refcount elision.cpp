@@ -0,0 +1,169 @@
+//
+//  refcount elision.cpp
+//  STELA
+//
+//  Created by Indi Kernick on 18/10/26.
+//  Copyright © 2026 Indi Kernick. All rights reserved.
+//
+
+#include "refcount elision.hpp"
+
+#include <vector>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include <llvm/Transforms/Utils/Mem2Reg.h>
+#include <llvm/Transforms/Scalar/EarlyCSE.h>
+#include <llvm/Transforms/IPO/AlwaysInliner.h>
+#include <llvm/Transforms/Scalar/SimplifyCFG.h>
+
+using namespace stela;
+
+namespace {
+
+struct RefCountFuncs {
+  llvm::Function *inc;
+  llvm::Function *dec;
+};
+
+RefCountFuncs getRefCountFuncs(llvm::Module &module) {
+  return {module.getFunction("ptr_inc"), module.getFunction("ptr_dec")};
+}
+
+void replaceAttr(
+  llvm::Function *func,
+  const llvm::Attribute::AttrKind from,
+  const llvm::Attribute::AttrKind to
+) {
+  if (func && func->hasFnAttribute(from)) {
+    func->removeFnAttr(from);
+    func->addFnAttr(to);
+  }
+}
+
+/// Stop ptr_inc and ptr_dec from being inlined into their callers
+class OutlineRefCountsPass : public llvm::PassInfoMixin<OutlineRefCountsPass> {
+public:
+  llvm::PreservedAnalyses run(llvm::Module &module, llvm::ModuleAnalysisManager &) {
+    const RefCountFuncs funcs = getRefCountFuncs(module);
+    replaceAttr(funcs.inc, llvm::Attribute::AlwaysInline, llvm::Attribute::NoInline);
+    replaceAttr(funcs.dec, llvm::Attribute::AlwaysInline, llvm::Attribute::NoInline);
+    return llvm::PreservedAnalyses::none();
+  }
+};
+
+/// Allow ptr_inc and ptr_dec to be inlined again once the elision is done
+class InlineRefCountsPass : public llvm::PassInfoMixin<InlineRefCountsPass> {
+public:
+  llvm::PreservedAnalyses run(llvm::Module &module, llvm::ModuleAnalysisManager &) {
+    const RefCountFuncs funcs = getRefCountFuncs(module);
+    replaceAttr(funcs.inc, llvm::Attribute::NoInline, llvm::Attribute::AlwaysInline);
+    replaceAttr(funcs.dec, llvm::Attribute::NoInline, llvm::Attribute::AlwaysInline);
+    return llvm::PreservedAnalyses::none();
+  }
+};
+
+/// The pointer whose reference count is changed by a call to ptr_inc or
+/// ptr_dec
+llvm::Value *changedPtr(llvm::CallInst *call) {
+  return call->getArgOperand(call->arg_size() - 1)->stripPointerCasts();
+}
+
+/// Remove the most recent change to the pointer from the pending changes.
+/// Returns null if the pointer hasn't been changed
+llvm::CallInst *takeChange(std::vector<llvm::CallInst *> &changes, llvm::Value *ptr) {
+  for (auto c = changes.rbegin(); c != changes.rend(); ++c) {
+    llvm::CallInst *call = *c;
+    if (changedPtr(call) == ptr) {
+      changes.erase(std::next(c).base());
+      return call;
+    }
+  }
+  return nullptr;
+}
+
+// An increment followed by a decrement of the same pointer can be removed if
+// nothing between them could release the object. A decrement might destroy an
+// object that owns the pointer so only the increments that are after the most
+// recent decrement are considered. A copy that is followed by the destruction
+// of its source is removed this way and becomes a move.
+//
+// A decrement followed by an increment of the same pointer can also be removed.
+// The object cannot have been destroyed by the decrement because the increment
+// would then be a use-after-free. This is equivalent to sinking the release
+// past the increment. Releases can be sunk past other releases but not past a
+// call that might read or change the reference count.
+
+bool elideBlock(llvm::BasicBlock &block, const RefCountFuncs funcs) {
+  std::vector<llvm::CallInst *> retains;
+  std::vector<llvm::CallInst *> releases;
+  std::vector<llvm::CallInst *> dead;
+  
+  for (llvm::Instruction &inst : block) {
+    auto *call = llvm::dyn_cast<llvm::CallInst>(&inst);
+    if (!call || llvm::isa<llvm::IntrinsicInst>(call)) {
+      continue;
+    }
+    llvm::Function *callee = call->getCalledFunction();
+    if (callee && callee == funcs.inc) {
+      if (llvm::CallInst *release = takeChange(releases, changedPtr(call))) {
+        dead.push_back(release);
+        dead.push_back(call);
+      } else {
+        retains.push_back(call);
+      }
+    } else if (callee && callee == funcs.dec) {
+      if (llvm::CallInst *retain = takeChange(retains, changedPtr(call))) {
+        dead.push_back(retain);
+        dead.push_back(call);
+      } else {
+        retains.clear();
+        releases.push_back(call);
+      }
+    } else {
+      retains.clear();
+      releases.clear();
+    }
+  }
+  
+  for (llvm::CallInst *call : dead) {
+    call->eraseFromParent();
+  }
+  return !dead.empty();
+}
+
+class RefCountElisionPass : public llvm::PassInfoMixin<RefCountElisionPass> {
+public:
+  llvm::PreservedAnalyses run(llvm::Function &func, llvm::FunctionAnalysisManager &) {
+    const RefCountFuncs funcs = getRefCountFuncs(*func.getParent());
+    if (!funcs.inc || !funcs.dec) {
+      return llvm::PreservedAnalyses::all();
+    }
+    bool changed = false;
+    for (llvm::BasicBlock &block : func) {
+      changed |= elideBlock(block, funcs);
+    }
+    if (!changed) {
+      return llvm::PreservedAnalyses::all();
+    }
+    llvm::PreservedAnalyses preserved;
+    preserved.preserveSet<llvm::CFGAnalyses>();
+    return preserved;
+  }
+};
+
+}
+
+void stela::addRefCountElision(llvm::ModulePassManager &passes) {
+  passes.addPass(OutlineRefCountsPass{});
+  passes.addPass(llvm::AlwaysInlinerPass{});
+  llvm::FunctionPassManager funcPasses;
+  // loads of the same pointer need to be the same value to be matched. The
+  // blocks of the inlined functions are merged so that more changes are in
+  // the same block
+  funcPasses.addPass(llvm::PromotePass{});
+  funcPasses.addPass(llvm::EarlyCSEPass{});
+  funcPasses.addPass(llvm::SimplifyCFGPass{});
+  funcPasses.addPass(RefCountElisionPass{});
+  passes.addPass(llvm::createModuleToFunctionPassAdaptor(std::move(funcPasses)));
+  passes.addPass(InlineRefCountsPass{});
+}
@@ -0,0 +1,25 @@
+//
+//  refcount elision.hpp
+//  STELA
+//
+//  Created by Indi Kernick on 18/10/26.
+//  Copyright © 2026 Indi Kernick. All rights reserved.
+//
+
+#ifndef stela_refcount_elision_hpp
+#define stela_refcount_elision_hpp
+
+#include <llvm/IR/PassManager.h>
+
+namespace stela {
+
+/// Remove the reference count changes that cancel each other out. The
+/// runtime functions are inlined while ptr_inc and ptr_dec are kept out of
+/// line so that an increment and a decrement of the same pointer can be
+/// matched. A copy that is followed by the destruction of its source
+/// becomes a move. Requires the inliner
+void addRefCountElision(llvm::ModulePassManager &);
+
+}
+
+#endif
@@ -0,0 +1,101 @@
+//
+//  target machine.cpp
+//  STELA
+//
+//  Created by Indi Kernick on 18/10/26.
+//  Copyright © 2026 Indi Kernick. All rights reserved.
+//
+
+#include "target machine.hpp"
+
+#include <llvm/IR/Module.h>
+#include "Log/log output.hpp"
+#include <llvm/Support/Host.h>
+#include "optimize module.hpp"
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/Target/TargetMachine.h>
+#include <llvm/Support/TargetRegistry.h>
+
+using namespace stela;
+
+std::string stela::targetCPU(const OptFlags opt) {
+  if (opt.cpu) {
+    return opt.cpu;
+  }
+  return llvm::sys::getHostCPUName().str();
+}
+
+std::vector<std::string> stela::targetFeatures(const OptFlags opt) {
+  std::vector<std::string> features;
+  if (opt.features) {
+    llvm::SmallVector<llvm::StringRef, 16> split;
+    llvm::StringRef{opt.features}.split(split, ',', -1, false);
+    for (const llvm::StringRef feature : split) {
+      features.push_back(feature.trim().str());
+    }
+  } else if (!opt.cpu) {
+    // the host CPU name alone doesn't say whether the OS has disabled
+    // something like AVX-512
+    llvm::StringMap<bool> host;
+    if (llvm::sys::getHostCPUFeatures(host)) {
+      for (const auto &feature : host) {
+        features.push_back((feature.getValue() ? "+" : "-") + feature.getKey().str());
+      }
+    }
+  }
+  return features;
+}
+
+std::unique_ptr<llvm::TargetMachine> stela::makeHostMachine(const OptFlags opt, Log &log) {
+  const std::string triple = llvm::sys::getProcessTriple();
+  std::string error;
+  const llvm::Target *target = llvm::TargetRegistry::lookupTarget(triple, error);
+  if (target == nullptr) {
+    log.error() << error << fatal;
+  }
+  std::unique_ptr<llvm::TargetMachine> machine{target->createTargetMachine(
+    triple,
+    targetCPU(opt),
+    llvm::join(targetFeatures(opt), ","),
+    {},
+    llvm::None,
+    llvm::None,
+    codeGenOpt(opt)
+  )};
+  if (machine == nullptr) {
+    log.error() << "Failed to create target machine" << fatal;
+  }
+  return machine;
+}
+
+void stela::setTarget(llvm::Module &module, const llvm::TargetMachine &machine) {
+  module.setTargetTriple(machine.getTargetTriple().str());
+  module.setDataLayout(machine.createDataLayout());
+  const llvm::StringRef cpu = machine.getTargetCPU();
+  const llvm::StringRef features = machine.getTargetFeatureString();
+  for (llvm::Function &func : module) {
+    if (func.isDeclaration()) {
+      continue;
+    }
+    func.addFnAttr("target-cpu", cpu);
+    if (features.empty()) {
+      func.removeFnAttr("target-features");
+    } else {
+      func.addFnAttr("target-features", features);
+    }
+  }
+}
+
+namespace {
+
+constexpr char host_addresses[] = "stela.host_addresses";
+
+}
+
+void stela::markHostAddresses(llvm::Module &module) {
+  module.addModuleFlag(llvm::Module::Error, host_addresses, 1);
+}
+
+bool stela::hasHostAddresses(const llvm::Module &module) {
+  return module.getModuleFlag(host_addresses) != nullptr;
+}
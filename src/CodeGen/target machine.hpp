@@ -0,0 +1,43 @@
+//
+//  target machine.hpp
+//  STELA
+//
+//  Created by Indi Kernick on 18/10/26.
+//  Copyright © 2026 Indi Kernick. All rights reserved.
+//
+
+#ifndef stela_target_machine_hpp
+#define stela_target_machine_hpp
+
+#include "code generation.hpp"
+
+namespace llvm {
+
+class TargetMachine;
+class Module;
+
+}
+
+namespace stela {
+
+class Log;
+
+/// OptFlags::cpu or the name of the host CPU
+std::string targetCPU(OptFlags);
+/// OptFlags::features split on commas. When neither the CPU nor the features
+/// are given, these are the features of the host CPU
+std::vector<std::string> targetFeatures(OptFlags);
+/// Create a machine for the host triple with the CPU and features of the flags
+std::unique_ptr<llvm::TargetMachine> makeHostMachine(OptFlags, Log &);
+/// Set the triple and data layout of the module and tag each function with
+/// the CPU and features of the machine so that the optimizer sees them
+void setTarget(llvm::Module &, const llvm::TargetMachine &);
+/// Mark a module that refers to addresses in the host process like the
+/// callbacks of OptFlags::allocator. Its machine code is only valid in the
+/// process that generated it
+void markHostAddresses(llvm::Module &);
+bool hasHostAddresses(const llvm::Module &);
+
+}
+
+#endif
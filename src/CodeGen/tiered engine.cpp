@@ -0,0 +1,378 @@
+//
+//  tiered engine.cpp
+//  STELA
+//
+//  Created by Indi Kernick on 18/10/26.
+//  Copyright © 2026 Indi Kernick. All rights reserved.
+//
+
+#include "tiered engine.hpp"
+
+#include <mutex>
+#include <thread>
+#include "gen helpers.hpp"
+#include "eager engine.hpp"
+#include "Log/log output.hpp"
+#include <condition_variable>
+#include "function builder.hpp"
+#include "Utils/unreachable.hpp"
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/ExecutionEngine/GenericValue.h>
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
+
+using namespace stela;
+
+namespace {
+
+/// Recompiles hot functions on a background thread. The optimized modules
+/// refer to the globals of the baseline module so both tiers share state
+class Tiering {
+public:
+  Tiering(llvm::SmallVector<char, 0> bitcode, std::vector<std::string> names, const EngineOpts &opts)
+    : bitcode{std::move(bitcode)}, names{std::move(names)}, opts{opts} {}
+  
+  ~Tiering() {
+    {
+      std::lock_guard lock{mutex};
+      stop = true;
+    }
+    wake.notify_one();
+    if (worker.joinable()) {
+      worker.join();
+    }
+  }
+  
+  /// Called by the stub of a function when it becomes hot
+  static void hot(Tiering *self, const uint32_t index) noexcept {
+    {
+      std::lock_guard lock{self->mutex};
+      self->pending.push_back(index);
+    }
+    self->wake.notify_one();
+  }
+  
+  void start(llvm::ExecutionEngine *engine) {
+    baseline = engine;
+    for (const std::string &name : names) {
+      entries.push_back(reinterpret_cast<std::atomic<uint64_t> *>(
+        baseline->getGlobalValueAddress(name + ".entry")
+      ));
+    }
+    worker = std::thread{[this] {
+      work();
+    }};
+  }
+  
+  size_t finish() {
+    std::unique_lock lock{mutex};
+    idle.wait(lock, [this] {
+      return pending.empty() && !busy;
+    });
+    return optimized;
+  }
+
+private:
+  struct Tier {
+    // the engine owns a module that belongs to the context
+    std::unique_ptr<llvm::LLVMContext> context;
+    std::unique_ptr<llvm::ExecutionEngine> engine;
+  };
+  
+  llvm::SmallVector<char, 0> bitcode;
+  std::vector<std::string> names;
+  std::vector<std::atomic<uint64_t> *> entries;
+  EngineOpts opts;
+  llvm::ExecutionEngine *baseline = nullptr;
+  std::vector<Tier> tiers;
+  
+  std::thread worker;
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable idle;
+  std::vector<uint32_t> pending;
+  size_t optimized = 0;
+  bool busy = false;
+  bool stop = false;
+  
+  void work() {
+    std::unique_lock lock{mutex};
+    while (true) {
+      wake.wait(lock, [this] {
+        return stop || !pending.empty();
+      });
+      if (stop) {
+        return;
+      }
+      // functions that become hot while a batch is compiling are put into
+      // the next batch
+      std::vector<uint32_t> batch = std::move(pending);
+      pending.clear();
+      busy = true;
+      lock.unlock();
+      const size_t count = compile(batch);
+      lock.lock();
+      optimized += count;
+      busy = false;
+      idle.notify_all();
+    }
+  }
+  
+  size_t compile(const std::vector<uint32_t> &batch) {
+    // the sink of the baseline compilation may not outlive the engine
+    NullSink sink;
+    Log log{sink, LogCat::generate};
+    Tier tier;
+    tier.context = std::make_unique<llvm::LLVMContext>();
+    const llvm::MemoryBufferRef ref{
+      llvm::StringRef{bitcode.data(), bitcode.size()}, "tier"
+    };
+    auto module = llvm::parseBitcodeFile(ref, *tier.context);
+    if (!module) {
+      llvm::consumeError(module.takeError());
+      return 0;
+    }
+    prepare(**module, batch);
+    
+    EngineOpts tierOpts;
+    tierOpts.opt = opts.opt;
+    tierOpts.findSymbol = [baseline = baseline, hook = opts.findSymbol](const std::string &name) {
+      if (const uint64_t addr = baseline->getGlobalValueAddress(name)) {
+        return addr;
+      }
+      return hook ? hook(name) : uint64_t{};
+    };
+    try {
+      tier.engine.reset(generateEager(std::move(*module), log, tierOpts));
+    } catch (FatalError &) {
+      return 0;
+    }
+    
+    size_t count = 0;
+    for (const uint32_t index : batch) {
+      if (const uint64_t addr = tier.engine->getFunctionAddress(names[index])) {
+        entries[index]->store(addr, std::memory_order_release);
+        ++count;
+      }
+    }
+    tiers.push_back(std::move(tier));
+    return count;
+  }
+  
+  /// Only the functions in the batch are compiled. The other extern functions
+  /// are available for inlining but calls to them go through the baseline
+  /// stubs
+  void prepare(llvm::Module &module, const std::vector<uint32_t> &batch) {
+    for (llvm::GlobalVariable &global : module.globals()) {
+      if (!global.isConstant() && !global.isDeclaration() && !global.hasAppendingLinkage()) {
+        global.setInitializer(nullptr);
+        global.setLinkage(llvm::GlobalValue::ExternalLinkage);
+      }
+    }
+    // the globals have already been initialized by the baseline
+    for (const char *list : {"llvm.global_ctors", "llvm.global_dtors"}) {
+      if (llvm::GlobalVariable *global = module.getNamedGlobal(list)) {
+        global->eraseFromParent();
+      }
+    }
+    for (uint32_t index = 0; index != names.size(); ++index) {
+      if (std::find(batch.cbegin(), batch.cend(), index) == batch.cend()) {
+        module.getFunction(names[index])->setLinkage(
+          llvm::GlobalValue::AvailableExternallyLinkage
+        );
+      }
+    }
+  }
+};
+
+/// The address of a host object as a constant pointer
+llvm::Constant *hostPtr(llvm::LLVMContext &ctx, const void *ptr, llvm::Type *type) {
+  return llvm::ConstantExpr::getIntToPtr(
+    llvm::ConstantInt::get(
+      llvm::Type::getInt64Ty(ctx),
+      static_cast<uint64_t>(reinterpret_cast<uintptr_t>(ptr))
+    ),
+    type
+  );
+}
+
+/// Replace the function with a stub that counts calls and then calls the
+/// current entry point of the function. The stub takes the name of the
+/// function so that callers and bindings call the stub
+void insertStub(
+  llvm::Function *func,
+  Tiering *tiering,
+  const uint32_t index,
+  const uint64_t threshold
+) {
+  llvm::Module *module = func->getParent();
+  llvm::LLVMContext &ctx = module->getContext();
+  llvm::Type *i32 = llvm::Type::getInt32Ty(ctx);
+  llvm::Type *i64 = llvm::Type::getInt64Ty(ctx);
+  
+  llvm::Function *stub = llvm::Function::Create(
+    func->getFunctionType(),
+    llvm::GlobalValue::ExternalLinkage,
+    "",
+    module
+  );
+  func->replaceAllUsesWith(stub);
+  stub->takeName(func);
+  stub->setAttributes(func->getAttributes());
+  func->setName(stub->getName() + ".tier0");
+  func->setLinkage(llvm::GlobalValue::InternalLinkage);
+  
+  auto *entry = new llvm::GlobalVariable{
+    *module,
+    func->getType(),
+    false,
+    llvm::GlobalValue::ExternalLinkage,
+    func,
+    stub->getName() + ".entry"
+  };
+  auto *count = new llvm::GlobalVariable{
+    *module,
+    i64,
+    false,
+    llvm::GlobalValue::InternalLinkage,
+    llvm::ConstantInt::get(i64, 0),
+    stub->getName() + ".count"
+  };
+  llvm::Type *hotParams[] = {llvm::Type::getInt8PtrTy(ctx), i32};
+  llvm::FunctionType *hotType = llvm::FunctionType::get(
+    llvm::Type::getVoidTy(ctx), hotParams, false
+  );
+  
+  FuncBuilder builder{stub};
+  llvm::BasicBlock *hotBlock = builder.makeBlock();
+  llvm::BasicBlock *callBlock = builder.makeBlock();
+  llvm::Value *prev = builder.ir.CreateAtomicRMW(
+    llvm::AtomicRMWInst::Add,
+    count,
+    llvm::ConstantInt::get(i64, 1),
+    llvm::AtomicOrdering::Monotonic
+  );
+  likely(builder.ir.CreateCondBr(
+    builder.ir.CreateICmpNE(prev, llvm::ConstantInt::get(i64, threshold - 1)),
+    callBlock,
+    hotBlock
+  ));
+  
+  builder.setCurr(hotBlock);
+  builder.ir.CreateCall(
+    hostPtr(ctx, reinterpret_cast<const void *>(&Tiering::hot), hotType->getPointerTo()),
+    {hostPtr(ctx, tiering, hotParams[0]), llvm::ConstantInt::get(i32, index)}
+  );
+  builder.ir.CreateBr(callBlock);
+  
+  builder.setCurr(callBlock);
+  llvm::LoadInst *target = builder.ir.CreateLoad(entry);
+  target->setAtomic(llvm::AtomicOrdering::Acquire);
+  target->setAlignment(8);
+  std::vector<llvm::Value *> args;
+  for (llvm::Argument &arg : stub->args()) {
+    args.push_back(&arg);
+  }
+  llvm::CallInst *call = builder.ir.CreateCall(target, args);
+  call->setAttributes(func->getAttributes());
+  call->setTailCallKind(llvm::CallInst::TCK_MustTail);
+  if (call->getType()->isVoidTy()) {
+    builder.ir.CreateRetVoid();
+  } else {
+    builder.ir.CreateRet(call);
+  }
+}
+
+/// ExecutionEngine adapter that owns the baseline engine and the tiering
+/// thread
+class TieredEngine final : public llvm::ExecutionEngine {
+public:
+  TieredEngine(
+    std::unique_ptr<llvm::ExecutionEngine> baseline,
+    std::unique_ptr<Tiering> tiering
+  ) : llvm::ExecutionEngine{baseline->getDataLayout()},
+      baseline{std::move(baseline)},
+      tiering{std::move(tiering)} {}
+  
+  ~TieredEngine() {
+    // the optimized code refers to the baseline globals
+    tiering.reset();
+  }
+  
+  llvm::GenericValue runFunction(llvm::Function *, llvm::ArrayRef<llvm::GenericValue>) override {
+    UNREACHABLE();
+  }
+  void *getPointerToNamedFunction(llvm::StringRef name, bool abort) override {
+    return baseline->getPointerToNamedFunction(name, abort);
+  }
+  void *getPointerToFunction(llvm::Function *func) override {
+    return getPointerToNamedFunction(func->getName(), false);
+  }
+  uint64_t getGlobalValueAddress(const std::string &name) override {
+    return baseline->getGlobalValueAddress(name);
+  }
+  uint64_t getFunctionAddress(const std::string &name) override {
+    return baseline->getFunctionAddress(name);
+  }
+  void runStaticConstructorsDestructors(const bool isDtors) override {
+    baseline->runStaticConstructorsDestructors(isDtors);
+  }
+  
+  size_t finish() {
+    return tiering->finish();
+  }
+
+private:
+  std::unique_ptr<llvm::ExecutionEngine> baseline;
+  std::unique_ptr<Tiering> tiering;
+};
+
+}
+
+llvm::ExecutionEngine *stela::generateTiered(
+  std::unique_ptr<llvm::Module> module,
+  Log &log,
+  const EngineOpts &opts
+) {
+  log.status() << "Compiling baseline tier" << endlog;
+  
+  // the tiers share globals so the globals must be visible by name
+  for (llvm::GlobalVariable &global : module->globals()) {
+    if (!global.isConstant() && global.hasLocalLinkage()) {
+      global.setLinkage(llvm::GlobalValue::ExternalLinkage);
+    }
+  }
+  std::vector<std::string> names;
+  for (llvm::Function &func : *module) {
+    if (!func.isDeclaration() && func.hasExternalLinkage()) {
+      names.push_back(func.getName().str());
+    }
+  }
+  
+  llvm::SmallVector<char, 0> bitcode;
+  llvm::raw_svector_ostream stream{bitcode};
+  llvm::WriteBitcodeToFile(*module, stream);
+  auto tiering = std::make_unique<Tiering>(std::move(bitcode), names, opts);
+  
+  for (uint32_t index = 0; index != names.size(); ++index) {
+    insertStub(
+      module->getFunction(names[index]),
+      tiering.get(),
+      index,
+      std::max(opts.tierThreshold, uint64_t{1})
+    );
+  }
+  
+  EngineOpts baseOpts;
+  baseOpts.opt = opt_none;
+  baseOpts.findSymbol = opts.findSymbol;
+  std::unique_ptr<llvm::ExecutionEngine> baseline{
+    generateEager(std::move(module), log, baseOpts)
+  };
+  tiering->start(baseline.get());
+  return new TieredEngine{std::move(baseline), std::move(tiering)};
+}
+
+size_t stela::finishTiering(llvm::ExecutionEngine *engine) {
+  return static_cast<TieredEngine *>(engine)->finish();
+}
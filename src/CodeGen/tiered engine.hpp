@@ -0,0 +1,26 @@
+//
+//  tiered engine.hpp
+//  STELA
+//
+//  Created by Indi Kernick on 18/10/26.
+//  Copyright © 2026 Indi Kernick. All rights reserved.
+//
+
+#ifndef stela_tiered_engine_hpp
+#define stela_tiered_engine_hpp
+
+#include "code generation.hpp"
+
+namespace stela {
+
+class Log;
+
+/// Compile the module with opt_none. Each extern function is called through
+/// a stub that counts calls and swaps to an optimized version once the
+/// function is hot. The returned engine only supports the subset of the
+/// ExecutionEngine interface used by binding.hpp
+llvm::ExecutionEngine *generateTiered(std::unique_ptr<llvm::Module>, Log &, const EngineOpts &);
+
+}
+
+#endif
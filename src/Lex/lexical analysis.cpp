@@ -12,6 +12,7 @@
 #include <algorithm>
 #include "Log/log output.hpp"
 #include "number literal.hpp"
+#include "Utils/phase timer.hpp"
 #include "Utils/parse string.hpp"
 
 using namespace stela;
@@ -174,7 +175,12 @@ bool parseMultiComment(Utils::ParseString &str, Log &log) {
 
 }
 
-Tokens stela::tokenize(const std::string_view source, LogSink &sink) {
+Tokens stela::tokenize(
+  const std::string_view source,
+  LogSink &sink,
+  CompileStats *stats
+) {
+  PhaseTimer timer{stats, &CompileStats::lexical};
   Log log{sink, LogCat::lexical};
   log.verbose() << "Parsing " << source.size() << " characters" << endlog;
   
@@ -186,6 +192,9 @@ Tokens stela::tokenize(const std::string_view source, LogSink &sink) {
     str.skipWhitespace();
     if (str.empty()) {
       log.verbose() << "Created " << tokens.size() << " tokens" << endlog;
+      if (stats) {
+        stats->tokens += tokens.size();
+      }
       return tokens;
     }
     
@@ -0,0 +1,35 @@
+//
+//  buffer sink.cpp
+//  STELA
+//
+//  Created by Indi Kernick on 18/10/26.
+//  Copyright © 2026 Indi Kernick. All rights reserved.
+//
+
+#include "buffer sink.hpp"
+
+#include <ostream>
+
+bool stela::BufferSink::writeHead(const LogInfo &) {
+  return true;
+}
+
+std::streambuf *stela::BufferSink::getBuf(const LogInfo &) {
+  return &buf;
+}
+
+void stela::BufferSink::writeTail(const LogInfo &info) {
+  messages.push_back({info, buf.str()});
+  buf.str({});
+}
+
+void stela::BufferSink::flush(LogSink &sink) {
+  for (const Message &message : messages) {
+    if (sink.writeHead(message.info)) {
+      std::ostream stream{sink.getBuf(message.info)};
+      stream << message.text;
+      sink.writeTail(message.info);
+    }
+  }
+  messages.clear();
+}
@@ -0,0 +1,42 @@
+//
+//  buffer sink.hpp
+//  STELA
+//
+//  Created by Indi Kernick on 18/10/26.
+//  Copyright © 2026 Indi Kernick. All rights reserved.
+//
+
+#ifndef stela_buffer_sink_hpp
+#define stela_buffer_sink_hpp
+
+#include "log.hpp"
+#include <vector>
+#include <sstream>
+
+namespace stela {
+
+/// Store messages so that they can be written to another sink later. Each
+/// thread of the parallel front-end writes to its own buffer and the buffers
+/// are written out in module order
+class BufferSink final : public LogSink {
+public:
+  bool writeHead(const LogInfo &) override;
+  std::streambuf *getBuf(const LogInfo &) override;
+  void writeTail(const LogInfo &) override;
+  
+  /// Write the stored messages to a sink
+  void flush(LogSink &);
+
+private:
+  struct Message {
+    LogInfo info;
+    std::string text;
+  };
+  
+  std::vector<Message> messages;
+  std::stringbuf buf;
+};
+
+}
+
+#endif
@@ -8,10 +8,24 @@
 
 #include "ast.hpp"
 
+#include "Utils/phase timer.hpp"
 #include "Utils/unreachable.hpp"
 
 using namespace stela;
 
+namespace {
+
+thread_local size_t nodes = 0;
+
+}
+
+size_t stela::nodeCount() {
+  return nodes;
+}
+
+ast::Node::Node() {
+  ++nodes;
+}
 ast::Node::~Node() = default;
 ast::Type::~Type() = default;
 ast::Expression::~Expression() = default;
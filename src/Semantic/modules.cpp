@@ -8,6 +8,8 @@
 
 #include "modules.hpp"
 
+#include <unordered_set>
+#include <unordered_map>
 #include "Log/log output.hpp"
 #include "Utils/algorithms.hpp"
 
@@ -19,43 +21,46 @@ class Visitor {
 public:
   Visitor(const ASTs &asts, const ast::Names &compiled, LogSink &sink)
     : order{},
-      stack{},
+      active(asts.size(), false),
       visited(asts.size(), false),
+      index{},
+      compiled{compiled.cbegin(), compiled.cend()},
       asts{asts},
-      compiled{compiled},
       log{sink, LogCat::semantic} {
     order.reserve(asts.size());
-    stack.reserve(asts.size());
+    index.reserve(asts.size());
+    for (size_t i = 0; i != asts.size(); ++i) {
+      index.emplace(asts[i].name, i);
+    }
   }
-
+  
   void checkCycle(const size_t index, const ast::Name &name) {
-    if (contains(stack, index)) {
+    if (active[index]) {
       log.error() << "Cyclic dependencies detected in module \"" << name << "\"" << fatal;
     }
   }
-
+  
   void visit(const ast::Name &name) {
-    for (size_t i = 0; i != asts.size(); ++i) {
-      if (asts[i].name == name) {
-        checkCycle(i, name);
-        return visit(i);
-      }
+    const size_t i = find(name);
+    if (i != asts.size()) {
+      checkCycle(i, name);
+      return visit(i);
     }
-    if (!contains(compiled, name)) {
+    if (compiled.count(name) == 0) {
       log.error() << "Module \"" << name << "\" not found" << fatal;
     }
   }
-
+  
   void visit(const size_t index) {
     if (visited[index]) {
       return;
     }
     visited[index] = true;
-    stack.push_back(index);
+    active[index] = true;
     for (const ast::Name &dep : asts[index].imports) {
       visit(dep);
     }
-    stack.pop_back();
+    active[index] = false;
     order.push_back(index);
   }
   
@@ -65,13 +70,20 @@ public:
     }
   }
   
+  /// Returns asts.size() if the module is not in the list
+  size_t find(const ast::Name &name) const {
+    const auto iter = index.find(name);
+    return iter == index.cend() ? asts.size() : iter->second;
+  }
+  
   ModuleOrder order;
 
 private:
-  std::vector<size_t> stack;
+  std::vector<bool> active;
   std::vector<bool> visited;
+  std::unordered_map<ast::Name, size_t> index;
+  std::unordered_set<ast::Name> compiled;
   const ASTs &asts;
-  const ast::Names &compiled;
   Log log;
 };
 
@@ -102,3 +114,30 @@ ModuleOrder stela::findModuleOrder(const ASTs &asts, const ast::Names &compiled,
   visitor.visit();
   return visitor.order;
 }
+
+ModuleWaves stela::findModuleWaves(const ASTs &asts, LogSink &sink) {
+  return findModuleWaves(asts, {}, sink);
+}
+
+ModuleWaves stela::findModuleWaves(const ASTs &asts, const ast::Names &compiled, LogSink &sink) {
+  checkDuplicateModules(asts, compiled, sink);
+  Visitor visitor{asts, compiled, sink};
+  visitor.visit();
+  
+  // a module goes in the wave after the last wave that it imports from
+  ModuleWaves waves;
+  std::vector<size_t> depth(asts.size(), 0);
+  for (const size_t index : visitor.order) {
+    for (const ast::Name &dep : asts[index].imports) {
+      const size_t i = visitor.find(dep);
+      if (i != asts.size()) {
+        depth[index] = std::max(depth[index], depth[i] + 1);
+      }
+    }
+    if (depth[index] == waves.size()) {
+      waves.emplace_back();
+    }
+    waves[depth[index]].push_back(index);
+  }
+  return waves;
+}
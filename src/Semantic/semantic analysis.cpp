@@ -12,8 +12,11 @@
 #include "check scopes.hpp"
 #include "scope manager.hpp"
 #include "Log/log output.hpp"
+#include "Log/buffer sink.hpp"
 #include "builtin symbols.hpp"
 #include "syntax analysis.hpp"
+#include "Utils/phase timer.hpp"
+#include "Utils/parallel for.hpp"
 
 using namespace stela;
 
@@ -26,32 +29,101 @@ Symbols stela::initModules(LogSink &) {
 
 namespace {
 
-void compileModuleImpl(Symbols &syms, AST &ast, Log &log) {
+/// Returns the namespace scope of the module
+sym::Scope *analyseModule(
+  const sym::Builtins &builtins,
+  sym::Scopes &scopes,
+  sym::Scope *parent,
+  AST &ast,
+  Log &log
+) {
   log.module({});
   log.status() << "Analysing module \"" << ast.name << "\"" << endlog;
   log.module(ast.name);
-  ScopeMan man{syms.scopes, syms.global};
+  ScopeMan man{scopes, parent};
   man.enterScope(ast.name);
-  syms.global = man.cur();
-  traverse({syms.builtins, man, log}, ast.global);
+  sym::Scope *global = man.cur();
+  traverse({builtins, man, log}, ast.global);
+  return global;
+}
+
+void moveDecls(Symbols &syms, AST &ast) {
   std::move(ast.global.begin(), ast.global.end(), std::back_inserter(syms.decls));
   ast.global.clear();
 }
 
+void compileModuleImpl(Symbols &syms, AST &ast, Log &log) {
+  syms.global = analyseModule(syms.builtins, syms.scopes, syms.global, ast, log);
+  moveDecls(syms, ast);
+}
+
+size_t countSymbols(const sym::Scopes &scopes) {
+  size_t count = 0;
+  for (const sym::ScopePtr &scope : scopes) {
+    count += scope->table.size();
+  }
+  return count;
+}
+
+/// Adds the time spent in semantic analysis and the number of symbols created
+/// to the stats
+class SemanticStats {
+public:
+  SemanticStats(const Symbols &syms, CompileStats *stats)
+    : timer{stats, &CompileStats::semantic},
+      syms{syms},
+      stats{stats},
+      symbols{stats ? countSymbols(syms.scopes) : 0} {}
+  ~SemanticStats() {
+    if (stats) {
+      stats->symbols += countSymbols(syms.scopes) - symbols;
+    }
+  }
+
+private:
+  PhaseTimer timer;
+  const Symbols &syms;
+  CompileStats *stats;
+  size_t symbols;
+};
+
 }
 
-void stela::compileModule(Symbols &syms, AST &ast, LogSink &sink) {
+void stela::compileModule(Symbols &syms, AST &ast, LogSink &sink, CompileStats *stats) {
+  SemanticStats semStats{syms, stats};
   Log log{sink, LogCat::semantic};
   compileModuleImpl(syms, ast, log);
   checkScopes(log, syms);
 }
 
-void stela::compileModule(Symbols &syms, std::string_view source, LogSink &sink) {
-  AST ast = createAST(source, sink);
-  compileModule(syms, ast, sink);
+void stela::compileModule(
+  Symbols &syms,
+  const std::string_view source,
+  LogSink &sink,
+  CompileStats *stats
+) {
+  AST ast = createAST(source, sink, stats);
+  compileModule(syms, ast, sink, stats);
 }
 
-void stela::compileModules(Symbols &syms, const ModuleOrder &order, ASTs &asts, LogSink &sink) {
+void stela::compileModuleUnchecked(Symbols &syms, AST &ast, LogSink &sink) {
+  Log log{sink, LogCat::semantic};
+  compileModuleImpl(syms, ast, log);
+}
+
+void stela::checkUnused(const Symbols &syms, LogSink &sink) {
+  Log log{sink, LogCat::semantic};
+  checkScopes(log, syms);
+}
+
+void stela::compileModules(
+  Symbols &syms,
+  const ModuleOrder &order,
+  ASTs &asts,
+  LogSink &sink,
+  CompileStats *stats
+) {
+  SemanticStats semStats{syms, stats};
   Log log{sink, LogCat::semantic};
   for (const size_t index : order) {
     compileModuleImpl(syms, asts[index], log);
@@ -59,6 +131,61 @@ void stela::compileModules(Symbols &syms, const ModuleOrder &order, ASTs &asts,
   checkScopes(log, syms);
 }
 
-void stela::compileModules(Symbols &syms, ASTs &asts, LogSink &sink) {
-  compileModules(syms, findModuleOrder(asts, sink), asts, sink);
+void stela::compileModules(Symbols &syms, ASTs &asts, LogSink &sink, CompileStats *stats) {
+  compileModules(syms, findModuleOrder(asts, sink), asts, sink, stats);
+}
+
+void stela::compileModules(
+  Symbols &syms,
+  const ModuleWaves &waves,
+  ASTs &asts,
+  LogSink &sink,
+  const unsigned threads,
+  CompileStats *stats
+) {
+  SemanticStats semStats{syms, stats};
+  Log log{sink, LogCat::semantic};
+  for (const ModuleOrder &wave : waves) {
+    std::vector<sym::Scopes> scopes(wave.size());
+    std::vector<BufferSink> buffers(wave.size());
+    sym::Scope *const parent = syms.global;
+    std::exception_ptr error;
+    try {
+      // builtin and imported types are shared by the modules of the wave
+      SharedObjectsScope shared;
+      parallelFor(wave.size(), threads, [&](const size_t m) {
+        Log modLog{buffers[m], LogCat::semantic};
+        analyseModule(syms.builtins, scopes[m], parent, asts[wave[m]], modLog);
+      });
+    } catch (...) {
+      error = std::current_exception();
+    }
+    for (BufferSink &buffer : buffers) {
+      buffer.flush(sink);
+    }
+    if (error) {
+      std::rethrow_exception(error);
+    }
+    
+    // chain the modules of the wave together so that the next wave can see
+    // all of them
+    for (size_t m = 0; m != wave.size(); ++m) {
+      sym::Scope *global = scopes[m].front().get();
+      global->parent = syms.global;
+      syms.global = global;
+      std::move(scopes[m].begin(), scopes[m].end(), std::back_inserter(syms.scopes));
+      moveDecls(syms, asts[wave[m]]);
+    }
+  }
+  checkScopes(log, syms);
+}
+
+void stela::compileModules(
+  Symbols &syms,
+  ASTs &asts,
+  LogSink &sink,
+  const unsigned threads,
+  CompileStats *stats
+) {
+  compileModules(syms, findModuleWaves(asts, sink), asts, sink, threads, stats);
 }
@@ -9,15 +9,20 @@
 #include "syntax analysis.hpp"
 
 #include "parse decl.hpp"
+#include "Log/buffer sink.hpp"
 #include "Log/log output.hpp"
 #include "lexical analysis.hpp"
+#include "Utils/phase timer.hpp"
+#include "Utils/parallel for.hpp"
 
 using namespace stela;
 
-AST stela::createAST(const Tokens &tokens, LogSink &sink) {
+AST stela::createAST(const Tokens &tokens, LogSink &sink, CompileStats *stats) {
+  PhaseTimer timer{stats, &CompileStats::syntax};
+  const size_t nodes = nodeCount();
   Log log{sink, LogCat::syntax};
   log.verbose() << "Parsing " << tokens.size() << " tokens" << endlog;
-
+  
   AST ast;
   ParseTokens tok(tokens, log);
   
@@ -48,10 +53,37 @@ AST stela::createAST(const Tokens &tokens, LogSink &sink) {
   }
   
   log.verbose() << "Created AST with " << ast.global.size() << " global nodes" << endlog;
+  if (stats) {
+    stats->nodes += nodeCount() - nodes;
+  }
   
   return ast;
 }
 
-AST stela::createAST(const std::string_view source, LogSink &sink) {
-  return createAST(tokenize(source, sink), sink);
+AST stela::createAST(const std::string_view source, LogSink &sink, CompileStats *stats) {
+  return createAST(tokenize(source, sink, stats), sink, stats);
+}
+
+ASTs stela::createASTs(
+  const std::vector<std::string_view> &sources,
+  LogSink &sink,
+  const unsigned threads
+) {
+  ASTs asts(sources.size());
+  std::vector<BufferSink> buffers(sources.size());
+  std::exception_ptr error;
+  try {
+    parallelFor(sources.size(), threads, [&](const size_t s) {
+      asts[s] = createAST(sources[s], buffers[s]);
+    });
+  } catch (...) {
+    error = std::current_exception();
+  }
+  for (BufferSink &buffer : buffers) {
+    buffer.flush(sink);
+  }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+  return asts;
 }
@@ -0,0 +1,68 @@
+//
+//  parallel for.hpp
+//  STELA
+//
+//  Created by Indi Kernick on 18/10/26.
+//  Copyright © 2026 Indi Kernick. All rights reserved.
+//
+
+#ifndef stela_parallel_for_hpp
+#define stela_parallel_for_hpp
+
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <exception>
+
+namespace stela {
+
+/// Call the function with each index in [0, count) on up to the given number
+/// of threads (including the calling thread). No more indices are handed
+/// out after an exception is thrown and the first exception is rethrown on
+/// the calling thread
+template <typename Func>
+void parallelFor(const size_t count, const unsigned threads, Func func) {
+  if (threads <= 1 || count <= 1) {
+    for (size_t i = 0; i != count; ++i) {
+      func(i);
+    }
+    return;
+  }
+  
+  std::atomic<size_t> next = 0;
+  std::exception_ptr error;
+  std::mutex errorMutex;
+  const auto work = [&] {
+    for (size_t i = next++; i < count; i = next++) {
+      try {
+        func(i);
+      } catch (...) {
+        std::lock_guard lock{errorMutex};
+        if (!error) {
+          error = std::current_exception();
+        }
+        next = count;
+      }
+    }
+  };
+  
+  std::vector<std::thread> workers;
+  const size_t extra = std::min(static_cast<size_t>(threads), count) - 1;
+  workers.reserve(extra);
+  for (size_t t = 0; t != extra; ++t) {
+    workers.emplace_back(work);
+  }
+  work();
+  for (std::thread &worker : workers) {
+    worker.join();
+  }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+}
+
+#endif
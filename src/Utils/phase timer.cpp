@@ -0,0 +1,46 @@
+//
+//  phase timer.cpp
+//  STELA
+//
+//  Created by Indi Kernick on 18/10/26.
+//  Copyright © 2026 Indi Kernick. All rights reserved.
+//
+
+#include "phase timer.hpp"
+
+#ifdef STELA_ALLOC_STATS
+
+#include <new>
+#include <cstdlib>
+
+namespace {
+
+thread_local size_t allocations = 0;
+
+}
+
+// Replacing the global operator new affects the whole program so this is
+// opt-in. The array and sized forms call these by default
+void *operator new(const size_t size) {
+  ++allocations;
+  if (void *ptr = std::malloc(size ? size : 1)) {
+    return ptr;
+  }
+  throw std::bad_alloc{};
+}
+
+void operator delete(void *ptr) noexcept {
+  std::free(ptr);
+}
+
+size_t stela::allocCount() {
+  return allocations;
+}
+
+#else
+
+size_t stela::allocCount() {
+  return 0;
+}
+
+#endif
@@ -0,0 +1,52 @@
+//
+//  phase timer.hpp
+//  STELA
+//
+//  Created by Indi Kernick on 18/10/26.
+//  Copyright © 2026 Indi Kernick. All rights reserved.
+//
+
+#ifndef stela_phase_timer_hpp
+#define stela_phase_timer_hpp
+
+#include "compile stats.hpp"
+
+namespace stela {
+
+/// Number of calls to operator new on this thread. Always 0 unless STELA is
+/// built with STELA_ALLOC_STATS
+size_t allocCount();
+/// Number of AST nodes created on this thread
+size_t nodeCount();
+
+/// Adds the time and allocations between construction and destruction to a
+/// phase. Does nothing if the stats are null
+class PhaseTimer {
+public:
+  PhaseTimer(CompileStats *stats, PhaseStats CompileStats::*member)
+    : phase{stats ? &(stats->*member) : nullptr},
+      start{Clock::now()},
+      allocs{allocCount()} {}
+  ~PhaseTimer() {
+    if (phase) {
+      phase->time += std::chrono::duration_cast<std::chrono::nanoseconds>(
+        Clock::now() - start
+      );
+      phase->allocations += allocCount() - allocs;
+    }
+  }
+  
+  PhaseTimer(const PhaseTimer &) = delete;
+  PhaseTimer &operator=(const PhaseTimer &) = delete;
+
+private:
+  using Clock = std::chrono::steady_clock;
+  
+  PhaseStats *phase;
+  Clock::time_point start;
+  size_t allocs;
+};
+
+}
+
+#endif
@@ -8,4 +8,131 @@
 
 #include <benchmark/benchmark.h>
 
+#include <thread>
+#include <algorithm>
+#include <STELA/llvm.hpp>
+#include <llvm/IR/Module.h>
 #include <STELA/reflection.hpp>
+#include <STELA/code generation.hpp>
+#include <STELA/syntax analysis.hpp>
+#include <STELA/semantic analysis.hpp>
+
+using namespace stela;
+
+namespace {
+
+LogSink &log() {
+  static StreamSink stream;
+  static FilterSink filter{stream, LogPri::warning};
+  return filter;
+}
+
+void ensureLLVM() {
+  if (!stela::hasLLVM()) {
+    stela::initLLVM();
+  }
+}
+
+/// A module with many independent functions
+std::string makeLargeSource(const int funcs) {
+  std::string source;
+  for (int f = 0; f != funcs; ++f) {
+    const std::string num = std::to_string(f);
+    const std::string mod = std::to_string(f % 7 + 2);
+    source += "extern func calc" + num + R"((n: uint) {
+      var array: [uint];
+      for (i := 0u; i != n; i++) {
+        if (i % 3u == 0u || i % )" + mod + R"(u == 0u) {
+          push_back(array, i * )" + num + R"(u);
+        }
+      }
+      var sum = 0u;
+      for (i := 0u; i != size(array); i++) {
+        sum += array[i];
+      }
+      return sum;
+    }
+    )";
+  }
+  return source;
+}
+
+/// Many small modules that import a common module
+std::vector<std::string> makeModuleSources(const int modules) {
+  std::vector<std::string> sources;
+  sources.push_back(R"(
+    module Base;
+  
+    type Vec2 struct {
+      x: real;
+      y: real;
+    };
+  
+    extern func (self: Vec2) dot(other: Vec2) {
+      return self.x * other.x + self.y * other.y;
+    }
+  )");
+  for (int m = 0; m != modules; ++m) {
+    const std::string num = std::to_string(m);
+    sources.push_back("module Mod" + num + R"(;
+      import Base;
+    
+      extern func length)" + num + R"((vec: Vec2) {
+        var sum = 0.0;
+        for (i := 0; i != )" + num + R"(; i++) {
+          sum += vec.dot(vec);
+        }
+        return sum;
+      }
+    )");
+  }
+  return sources;
+}
+
+void parallelFrontEnd(::benchmark::State &state) {
+  const std::vector<std::string> sources = makeModuleSources(1024);
+  const std::vector<std::string_view> views{sources.cbegin(), sources.cend()};
+  const auto threads = static_cast<unsigned>(state.range());
+  
+  for (auto _ : state) {
+    stela::ASTs asts = stela::createASTs(views, log(), threads);
+    stela::Symbols syms = stela::initModules(log());
+    stela::compileModules(syms, asts, log(), threads);
+  }
+}
+BENCHMARK(parallelFrontEnd)
+  ->RangeMultiplier(2)
+  ->Range(1, std::max(1u, std::thread::hardware_concurrency()))
+  ->Unit(benchmark::kMillisecond)
+  ->UseRealTime();
+
+void parallelCodegen(::benchmark::State &state) {
+  ensureLLVM();
+  
+  const std::string source = makeLargeSource(256);
+  EngineOpts opts;
+  opts.threads = static_cast<unsigned>(state.range());
+  
+  for (auto _ : state) {
+    state.PauseTiming();
+    stela::AST ast = stela::createAST(source, log());
+    stela::Symbols syms = stela::initModules(log());
+    stela::compileModule(syms, ast, log());
+    auto ctx = std::make_unique<stela::CompileCtx>();
+    std::unique_ptr<llvm::Module> module = stela::generateIR(*ctx, syms, log());
+    state.ResumeTiming();
+    
+    stela::generateCode(*ctx, std::move(module), log(), opts);
+    
+    state.PauseTiming();
+    ctx.reset();
+    state.ResumeTiming();
+  }
+}
+BENCHMARK(parallelCodegen)
+  ->RangeMultiplier(2)
+  ->Range(1, std::max(1u, std::thread::hardware_concurrency()))
+  ->Unit(benchmark::kMillisecond)
+  ->UseRealTime();
+
+}
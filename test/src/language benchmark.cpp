@@ -7,6 +7,7 @@
 //
 
 #include <iostream>
+#include <algorithm>
 #include <unordered_set>
 #include <STELA/llvm.hpp>
 #include <llvm/IR/Module.h>
@@ -21,13 +22,18 @@ using namespace stela;
 
 namespace {
 
+stela::CompileCtx &comp() {
+  static stela::CompileCtx ctx;
+  return ctx;
+}
+
 #define PRINT_CODE 0
 
 llvm::ExecutionEngine *generate(const stela::Symbols &syms, LogSink &log, [[maybe_unused]] const char *id) {
   #if PRINT_CODE
   static std::unordered_set<const char *> printed;
   const bool print = printed.insert(id).second;
-  std::unique_ptr<llvm::Module> module = stela::generateIR(syms, log);
+  std::unique_ptr<llvm::Module> module = stela::generateIR(comp(), syms, log);
   llvm::Module *modulePtr = module.get();
   std::string str;
   llvm::raw_string_ostream strStream(str);
@@ -37,7 +43,7 @@ llvm::ExecutionEngine *generate(const stela::Symbols &syms, LogSink &log, [[mayb
     std::cerr << "Generated IR\n" << str;
     str.clear();
   }
-  llvm::ExecutionEngine *engine = stela::generateCode(std::move(module), log);
+  llvm::ExecutionEngine *engine = stela::generateCode(comp(), std::move(module), log);
   if (print) {
     strStream << *modulePtr;
     strStream.flush();
@@ -45,7 +51,7 @@ llvm::ExecutionEngine *generate(const stela::Symbols &syms, LogSink &log, [[mayb
   }
   return engine;
   #else
-  return stela::generateCode(stela::generateIR(syms, log), log);
+  return stela::generateCode(comp(), syms, log);
   #endif
 }
 
@@ -116,6 +122,176 @@ void squaresNoReserve(::benchmark::State &state) {
 }
 BENCHMARK(squaresNoReserve)->Range(512, 65536)->Unit(benchmark::kMicrosecond);
 
+/// The subscripts in the for loop are known to be in bounds. The subscripts
+/// in the while loop are checked unless bounds checks are disabled
+void sumArray(::benchmark::State &state, const char *name) {
+  ensureLLVM();
+  
+  stela::AST ast = stela::createAST(R"(
+    extern func sum_for(array: [real]) {
+      var total = 0.0;
+      for (i := 0u; i < size(array); i++) {
+        total += array[i];
+      }
+      return total;
+    }
+    
+    extern func sum_while(array: [real]) {
+      var total = 0.0;
+      var i = 0u;
+      while (i < size(array)) {
+        total += array[i];
+        i++;
+      }
+      return total;
+    }
+  )", log());
+  stela::Symbols syms = stela::initModules(log());
+  stela::compileModule(syms, ast, log());
+  EngineOpts opts;
+  opts.opt.boundsChecks = state.range(1) != 0;
+  auto *engine = stela::generateCode(comp(), syms, log(), opts);
+  auto sum = GET_FUNC(name, Real(Array<Real>));
+  
+  const auto size = static_cast<Uint>(state.range(0));
+  auto array = makeArray<Real>(size);
+  std::fill_n(array->dat, size, Real{1});
+  
+  for (auto _ : state) {
+    ::benchmark::DoNotOptimize(sum(array));
+  }
+}
+BENCHMARK_CAPTURE(sumArray, for_loop, "sum_for")
+  ->Args({65536, 1})->Args({65536, 0})->Unit(benchmark::kMicrosecond);
+BENCHMARK_CAPTURE(sumArray, while_loop, "sum_while")
+  ->Args({65536, 1})->Args({65536, 0})->Unit(benchmark::kMicrosecond);
+
+/// Scripts that allocate an array header or closure data on each
+/// iteration. Allocations come from the pool by default. The second argument
+/// selects malloc_allocator (1), pool_allocator (2) or an arena for each
+/// call (3) so that they can be compared
+void allocation(::benchmark::State &state, const char *name) {
+  ensureLLVM();
+  
+  stela::AST ast = stela::createAST(R"(
+    extern func arrays(count: uint) {
+      var total = 0u;
+      for (i := 0u; i != count; i++) {
+        var array: [uint];
+        push_back(array, i);
+        total += array[0u];
+      }
+      return total;
+    }
+    
+    extern func nested(count: uint) {
+      var outer: [[uint]];
+      for (i := 0u; i != count; i++) {
+        var inner: [uint];
+        push_back(inner, i);
+        push_back(outer, inner);
+      }
+      return size(outer);
+    }
+    
+    extern func closures(count: uint) {
+      var total = 0u;
+      for (i := 0u; i != count; i++) {
+        let add = func(x: uint) {
+          return x + i;
+        };
+        total += add(1u);
+      }
+      return total;
+    }
+  )", log());
+  stela::Symbols syms = stela::initModules(log());
+  stela::compileModule(syms, ast, log());
+  EngineOpts opts;
+  if (state.range(1) == 1) {
+    opts.opt.allocator = &malloc_allocator;
+  } else if (state.range(1) == 2) {
+    opts.opt.allocator = &pool_allocator;
+  }
+  auto *engine = stela::generateCode(comp(), syms, log(), opts);
+  auto func = GET_FUNC(name, Uint(Uint));
+  const auto count = static_cast<Uint>(state.range(0));
+  const bool arena = state.range(1) == 3;
+  
+  for (auto _ : state) {
+    ::benchmark::DoNotOptimize(arena ? func.inArena(count) : func(count));
+  }
+}
+BENCHMARK_CAPTURE(allocation, arrays, "arrays")
+  ->Args({65536, 0})->Args({65536, 1})->Args({65536, 2})->Args({65536, 3})
+  ->Unit(benchmark::kMicrosecond);
+BENCHMARK_CAPTURE(allocation, nested, "nested")
+  ->Args({65536, 0})->Args({65536, 1})->Args({65536, 2})->Args({65536, 3})
+  ->Unit(benchmark::kMicrosecond);
+BENCHMARK_CAPTURE(allocation, closures, "closures")
+  ->Args({65536, 0})->Args({65536, 1})->Args({65536, 2})->Args({65536, 3})
+  ->Unit(benchmark::kMicrosecond);
+
+/// A struct of arrays is default constructed on each iteration. Empty arrays
+/// share immortal storage so this doesn't allocate
+void emptyArrays(::benchmark::State &state) {
+  ensureLLVM();
+  
+  GENERATE(R"(
+    type Lists struct {
+      names: [[char]];
+      values: [real];
+      counts: [uint];
+    };
+    
+    extern func make_lists(count: uint) {
+      var total = 0u;
+      for (i := 0u; i != count; i++) {
+        var lists: Lists;
+        total += size(lists.counts) + i;
+      }
+      return total;
+    }
+  )");
+  auto make_lists = GET_FUNC("make_lists", Uint(Uint));
+  
+  for (auto _ : state) {
+    ::benchmark::DoNotOptimize(make_lists(static_cast<Uint>(state.range())));
+  }
+}
+BENCHMARK(emptyArrays)->Arg(65536)->Unit(benchmark::kMicrosecond);
+
+/// Short arrays are built and read on each iteration. Arrays are bigger and
+/// signed subscripts are sign extended when built with STELA_64BIT_LENGTHS
+void smallArrays(::benchmark::State &state) {
+  ensureLLVM();
+  
+  GENERATE(R"(
+    extern func small_arrays(count: uint) {
+      var total = 0;
+      for (i := 0u; i != count; i++) {
+        var array: [sint];
+        push_back(array, 1);
+        push_back(array, 2);
+        push_back(array, 3);
+        var j = make sint size(array) - 1;
+        while (j >= 0) {
+          total += array[j];
+          j--;
+        }
+      }
+      return total;
+    }
+  )");
+  auto small_arrays = GET_FUNC("small_arrays", Sint(Uint));
+  
+  for (auto _ : state) {
+    ::benchmark::DoNotOptimize(small_arrays(static_cast<Uint>(state.range())));
+  }
+  state.counters["header_bytes"] = sizeof(ArrayStorage<Sint>);
+}
+BENCHMARK(smallArrays)->Arg(65536)->Unit(benchmark::kMicrosecond);
+
 void euler1_stela(::benchmark::State &state) {
   ensureLLVM();
   
@@ -37,7 +37,8 @@ int runTest(std::string &exec, const char *name) {
 
 int main(int, const char **argv) {
   stela::initLLVM();
-  llvm::LLVMContext &context = stela::getLLVM();
+  stela::CompileCtx ctx;
+  llvm::LLVMContext &context = ctx.llvm();
   
   auto module = std::make_unique<llvm::Module>("top", context);
   llvm::IRBuilder<> builder{context};
@@ -89,6 +90,7 @@ int main(int, const char **argv) {
     std::cerr << "Execution engine error: " << error << '\n';
     return 1;
   }
+  ctx.addEngine(engine);
   
   // generate code
   engine->finalizeObject();
@@ -101,8 +103,6 @@ int main(int, const char **argv) {
     std::cerr << "Error getting function\n";
   }
 
-  stela::quitLLVM();
-  
   std::string exec = argv[1];
   exec.push_back('/');
 
@@ -8,6 +8,7 @@
 
 #include <gtest/gtest.h>
 #include <STELA/modules.hpp>
+#include <STELA/compile stats.hpp>
 #include <STELA/syntax analysis.hpp>
 #include <STELA/semantic analysis.hpp>
 #include <STELA/c standard library.hpp>
@@ -410,6 +411,79 @@ TEST_F(Modules, Cmath) {
   compileModules(syms, order, asts, log());
 }
 
+TEST_F(Modules, Waves) {
+  ASTs asts;
+  asts.push_back(makeModuleAST("a", {"b", "c"}));
+  asts.push_back(makeModuleAST("b", {"d"}));
+  asts.push_back(makeModuleAST("c", {"d"}));
+  asts.push_back(makeModuleAST("d", {}));
+  asts.push_back(makeModuleAST("e", {}));
+  const ModuleWaves waves = findModuleWaves(asts, log());
+  ASSERT_EQ(waves.size(), 3);
+  EXPECT_EQ(waves[0], (ModuleOrder{3, 4})); // d e
+  EXPECT_EQ(waves[1], (ModuleOrder{1, 2})); // b c
+  EXPECT_EQ(waves[2], (ModuleOrder{0}));    // a
+}
+
+TEST_F(Modules, Parallel) {
+  std::vector<std::string> sources;
+  sources.push_back(R"(
+    module Base;
+  
+    type Number = real;
+  
+    type Vec2 struct {
+      x: Number;
+      y: Number;
+    };
+  )");
+  std::string top = "module Top;\n";
+  for (int m = 0; m != 32; ++m) {
+    const std::string name = "Mod" + std::to_string(m);
+    sources.push_back("module " + name + R"(;
+      import Base;
+    
+      func (self: Vec2) )" + "dot" + std::to_string(m) + R"((other: Vec2) -> Number {
+        return self.x * other.x + self.y * other.y;
+      }
+    )");
+    top += "import " + name + ";\n";
+  }
+  top += R"(
+    func test() {
+      let vec = make Vec2 {3.0, 4.0};
+      let a: real = vec.dot0(vec);
+      let b: real = vec.dot31(vec);
+    }
+  )";
+  sources.push_back(top);
+  
+  const std::vector<std::string_view> views{sources.cbegin(), sources.cend()};
+  ASTs asts = createASTs(views, log(), 4);
+  ASSERT_EQ(asts.size(), sources.size());
+  EXPECT_EQ(asts.back().name, "Top");
+  const ModuleWaves waves = findModuleWaves(asts, log());
+  ASSERT_EQ(waves.size(), 3);
+  EXPECT_EQ(waves[1].size(), 32);
+  
+  Symbols syms = initModules(log());
+  compileModules(syms, waves, asts, log(), 4);
+  EXPECT_EQ(syms.decls.size(), 2 + 32 + 1);
+}
+
+TEST_F(Modules, Parallel_error) {
+  std::vector<std::string_view> sources;
+  sources.push_back("module ModA; type Number = real;");
+  sources.push_back("module ModB; import ModA; let n: Number = true;");
+  sources.push_back("module ModC; import ModA; let n: Number = 1.0;");
+  ASTs asts = createASTs(sources, log(), 4);
+  Symbols syms = initModules(log());
+  EXPECT_THROW(compileModules(syms, asts, log(), 4), FatalError);
+  
+  sources.push_back("module ModD; let = 5;");
+  EXPECT_THROW(createASTs(sources, log(), 4), FatalError);
+}
+
 TEST(Func, Redef) {
   EXPECT_FAILS(R"(
     func myFunction() {
@@ -2390,6 +2464,37 @@ TEST(External_Func, Inside_func) {
   EXPECT_THROW(compileModule(syms, cmath, log()), FatalError);
 }
 
+TEST(Stats, Front_end) {
+  const char *source = R"(
+    type Vec2 struct {
+      x: real;
+      y: real;
+    };
+    
+    func (self: Vec2) dot(other: Vec2) {
+      return self.x * other.x + self.y * other.y;
+    }
+  )";
+  
+  CompileStats stats;
+  Symbols syms = initModules(log());
+  AST ast = createAST(source, log(), &stats);
+  compileModule(syms, ast, log(), &stats);
+  EXPECT_EQ(stats.tokens, 45);
+  EXPECT_NE(stats.nodes, 0);
+  EXPECT_NE(stats.symbols, 0);
+  EXPECT_NE(stats.lexical.time.count(), 0);
+  EXPECT_NE(stats.syntax.time.count(), 0);
+  EXPECT_NE(stats.semantic.time.count(), 0);
+  
+  const size_t nodes = stats.nodes;
+  const size_t symbols = stats.symbols;
+  ast = createAST(source, log(), &stats);
+  EXPECT_EQ(stats.tokens, 2 * 45);
+  EXPECT_EQ(stats.nodes, 2 * nodes);
+  EXPECT_EQ(stats.symbols, symbols);
+}
+
 #undef EXPECT_SUCCEEDS
 #undef EXPECT_FAILS
 